@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "arena.h"
+#include "malloc.h"
+#include "memprof.h"
+#include "log.h"
+
+#define ARENA_ALIGN       0x20
+#define ARENA_BASE_ALIGN  0x40 // for the SHA engine
+#define ARENA_MAX_BUFFERS 8
+
+static struct {
+	unsigned char* base;
+	size_t ceiling;
+
+	size_t top;   // metadata bump pointer
+	size_t last;  // offset of the most recent allocation, for ArenaRealloc
+	size_t limit; // where the I/O buffers start
+	size_t peak;
+
+	size_t iobuf_size;
+	unsigned iobuf_count;
+	bool iobuf_used[ARENA_MAX_BUFFERS];
+	unsigned iobuf_inuse;
+} arena;
+
+#ifdef GEKKO
+#include <ogc/lwp.h>
+
+static lwp_t owner = LWP_THREAD_NULL;
+
+void ArenaClaim(bool claim) {
+	owner = claim ? LWP_GetSelf() : LWP_THREAD_NULL;
+}
+
+#define CheckOwner() assert(owner == LWP_THREAD_NULL || owner == LWP_GetSelf())
+#else
+void ArenaClaim(bool claim) {}
+
+#define CheckOwner() ((void)0)
+#endif
+
+static void UpdatePeak(void) {
+	size_t footprint = arena.top + (arena.iobuf_inuse * arena.iobuf_size);
+	if (footprint > arena.peak)
+		arena.peak = footprint;
+}
+
+int ArenaInit(size_t ceiling, size_t iobuf_size, unsigned iobuf_count) {
+	if (arena.base)
+		return -EBUSY;
+
+	iobuf_size = __builtin_align_up(iobuf_size, ARENA_BASE_ALIGN);
+	ceiling    = __builtin_align_up(ceiling, ARENA_BASE_ALIGN);
+	if (iobuf_count > ARENA_MAX_BUFFERS || iobuf_size * iobuf_count >= ceiling)
+		return -EINVAL;
+
+	arena.base = aligned_alloc(ARENA_BASE_ALIGN, ceiling);
+	if (!arena.base)
+		return -ENOMEM;
+
+	arena.ceiling     = ceiling;
+	arena.top         = arena.last = arena.peak = 0;
+	arena.iobuf_size  = iobuf_size;
+	arena.iobuf_count = iobuf_count;
+	arena.iobuf_inuse = 0;
+	arena.limit       = ceiling - (iobuf_size * iobuf_count);
+	memset(arena.iobuf_used, 0, sizeof(arena.iobuf_used));
+
+	return 0;
+}
+
+void ArenaDeinit(void) {
+	free(arena.base);
+	arena.base = NULL;
+}
+
+void* ArenaAlloc(size_t size) {
+	size_t start = arena.top;
+
+	CheckOwner();
+	if (!arena.base)
+		return NULL;
+
+	size = __builtin_align_up(size ?: 1, ARENA_ALIGN);
+	if (size > arena.limit - start) {
+		LogPrintf("ArenaAlloc: out of memory (%zu + %zu bytes, %zu max)\n", start, size, arena.limit);
+		MemProfPrintCurrent();
+		return NULL;
+	}
+
+	arena.top  = start + size;
+	arena.last = start;
+	UpdatePeak();
+	MemProfAlloc(size);
+
+	return arena.base + start;
+}
+
+void* ArenaRealloc(void* ptr, size_t oldsize, size_t newsize) {
+	if (!ptr)
+		return ArenaAlloc(newsize);
+
+	size_t offset = (unsigned char*)ptr - arena.base;
+
+	CheckOwner();
+	// Most recent allocation? Then it can just grow in place.
+	if (offset == arena.last) {
+		size_t size = __builtin_align_up(newsize ?: 1, ARENA_ALIGN);
+		if (size > arena.limit - offset) {
+			LogPrintf("ArenaRealloc: out of memory (%zu + %zu bytes, %zu max)\n", offset, size, arena.limit);
+			MemProfPrintCurrent();
+			return NULL;
+		}
+
+		MemProfResize(arena.top - offset, size);
+
+		arena.top = offset + size;
+		UpdatePeak();
+		return ptr;
+	}
+
+	// Not the last one, so this one stays where it is until ArenaRelease (see arena.h).
+	void* newptr = ArenaAlloc(newsize);
+	if (newptr)
+		memcpy(newptr, ptr, oldsize < newsize ? oldsize : newsize);
+
+	return newptr;
+}
+
+size_t ArenaMark(void) {
+	return arena.top;
+}
+
+void ArenaRelease(size_t mark) {
+	CheckOwner();
+	if (mark > arena.top)
+		return;
+
+	MemProfFree(arena.top - mark);
+	arena.top  = mark;
+	arena.last = mark;
+}
+
+void* ArenaGetBuffer(void) {
+	CheckOwner();
+	for (unsigned i = 0; i < arena.iobuf_count; i++) {
+		if (arena.iobuf_used[i])
+			continue;
+
+		arena.iobuf_used[i] = true;
+		arena.iobuf_inuse++;
+		UpdatePeak();
+		MemProfAlloc(arena.iobuf_size);
+		return arena.base + arena.limit + (i * arena.iobuf_size);
+	}
+
+	return NULL;
+}
+
+void ArenaPutBuffer(void* buffer) {
+	if (!buffer)
+		return;
+
+	CheckOwner();
+	unsigned i = ((unsigned char*)buffer - (arena.base + arena.limit)) / arena.iobuf_size;
+	if (i < arena.iobuf_count && arena.iobuf_used[i]) {
+		arena.iobuf_used[i] = false;
+		arena.iobuf_inuse--;
+		MemProfFree(arena.iobuf_size);
+	}
+}
+
+size_t ArenaBufferSize(void) {
+	return arena.iobuf_size;
+}
+
+size_t ArenaCeiling(void) {
+	return arena.ceiling;
+}
+
+size_t ArenaPeak(void) {
+	return arena.peak;
+}
@@ -0,0 +1,36 @@
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * One block of memory for the whole restore session, allocated once at startup so
+ * a long batch can't fragment the heap underneath us.
+ *
+ * The bottom of the block is a bump allocator for metadata (certs, TMDs, tickets,
+ * content.map, ...). Releases are LIFO: ArenaRelease() throws away everything that
+ * was allocated after the mark.
+ * The top of the block is a fixed pool of large I/O buffers for content data.
+ *
+ * ArenaRealloc grows the most recent allocation in place. Anything older gets copied
+ * to a new block, and the old one stays taken until its mark is released, so only
+ * ever grow the last thing allocated (which is what WriteToBlob does).
+ *
+ * None of this is thread safe. Whoever runs the restore (the engine thread, see
+ * engine.h) claims it for the duration, and anyone else touching it asserts.
+ */
+
+int    ArenaInit(size_t ceiling, size_t iobuf_size, unsigned iobuf_count);
+void   ArenaDeinit(void);
+
+void*  ArenaAlloc(size_t size);
+void*  ArenaRealloc(void* ptr, size_t oldsize, size_t newsize);
+size_t ArenaMark(void);
+void   ArenaRelease(size_t mark);
+
+void*  ArenaGetBuffer(void);
+void   ArenaPutBuffer(void* buffer);
+size_t ArenaBufferSize(void);
+
+void   ArenaClaim(bool claim);
+
+size_t ArenaCeiling(void);
+size_t ArenaPeak(void);
@@ -0,0 +1,318 @@
+#ifdef BENCHMARK
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ogc/lwp_watchdog.h>
+
+#include "bench.h"
+#include "arena.h"
+#include "network.h"
+#include "nus.h"
+
+#define BENCH_ITERATIONS   16
+#define BENCH_TMD_CONTENTS 24  // about what the System Menu or an IOS has
+#define BENCH_MAP_ENTRIES  400 // a console that's seen a lot of updates
+
+#define BENCH(name, iterations, bytes, ...) do {			\
+	u64 _start = gettime();									\
+	for (int _i = 0; _i < (iterations); _i++) { __VA_ARGS__; }	\
+	Report(name, gettime() - _start, iterations, bytes);	\
+} while (0)
+
+static const aeskey BenchKey = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+
+static void Report(const char* name, u64 ticks, unsigned iterations, size_t bytes) {
+	u64 ns = ticks_to_nanosecs(ticks) / iterations;
+
+	printf("%-32s %12llu ns/op", name, ns);
+	if (bytes && ns)
+		printf(" %10.2f KB/s", (bytes / 1024.0) / (ns / 1000000000.0));
+
+	putchar('\n');
+}
+
+static void FillBuffer(unsigned char* buffer, size_t size) {
+	for (size_t i = 0; i < size; i++)
+		buffer[i] = i * 0x9E3779B1 >> 24;
+}
+
+static void MakeCert(void* signature, uint32_t sigtype, cert_rsa2048* cert, const char* issuer, const char* name) {
+	((sig_rsa2048*)signature)->type = sigtype;
+	cert->cert_type = 0x00000001;
+	strcpy(cert->issuer, issuer);
+	strncpy((char*)cert->cert_name, name, sizeof(cert->cert_name));
+}
+
+static void MakeCerts(RetailCerts* certs) {
+	memset(certs, 0, sizeof(RetailCerts));
+	MakeCert(&certs->CA.signature, ES_SIG_RSA4096, &certs->CA.cert, "Root", "CA00000001");
+	MakeCert(&certs->XS.signature, ES_SIG_RSA2048, &certs->XS.cert, "Root-CA00000001", "XS00000003");
+	MakeCert(&certs->CP.signature, ES_SIG_RSA2048, &certs->CP.cert, "Root-CA00000001", "CP00000004");
+}
+
+static void MakeTitle(struct Title* title) {
+	memset(title, 0, sizeof(struct Title));
+	title->id = 0x0001000248414241;
+
+	title->certs = ArenaAlloc(sizeof(RetailCerts));
+	MakeCerts(title->certs);
+
+	title->tmd_size = sizeof(sig_rsa2048) + sizeof(tmd) + (sizeof(tmd_content) * BENCH_TMD_CONTENTS);
+	title->s_tmd = ArenaAlloc(title->tmd_size);
+	memset(title->s_tmd, 0, title->tmd_size);
+	((sig_rsa2048*)title->s_tmd)->type = ES_SIG_RSA2048;
+	title->tmd = SIGNATURE_PAYLOAD(title->s_tmd);
+	title->tmd->title_id = title->id;
+	title->tmd->num_contents = BENCH_TMD_CONTENTS;
+	for (int i = 0; i < BENCH_TMD_CONTENTS; i++) {
+		tmd_content* content = title->tmd->contents + i;
+
+		content->cid   = i;
+		content->index = i;
+		content->type  = (i % 3) ? 0x0001 : 0x8001;
+		content->size  = 0x40000;
+		FillBuffer(content->hash, sizeof(sha1));
+		content->hash[0] = i;
+	}
+
+	title->tik_size = STD_SIGNED_TIK_SIZE;
+	title->s_tik = ArenaAlloc(title->tik_size);
+	memset(title->s_tik, 0, title->tik_size);
+	((sig_rsa2048*)title->s_tik)->type = ES_SIG_RSA2048;
+	title->ticket = SIGNATURE_PAYLOAD(title->s_tik);
+	title->ticket->titleid = title->id;
+	title->ticket->reserved[0xb] = 1;
+	FillBuffer(title->ticket->cipher_title_key, sizeof(aeskey));
+}
+
+static void BenchMetadata(void) {
+	size_t mark = ArenaMark();
+	struct Title title;
+	aeskey key;
+
+	MakeTitle(&title);
+
+	BENCH("GetTitleKey", 1024, 0, GetTitleKey(title.ticket, key));
+	BENCH("ChangeCommonKey", 1024, 0, ChangeCommonKey(title.ticket, _i & 1));
+	TitleCryptoInit(&title.crypto, title.ticket);
+	BENCH("ChangeTitleID", 1024, 0, ChangeTitleID(&title, title.id ^ (_i & 1)));
+
+	RetailCerts* certs = ArenaAlloc(sizeof(RetailCerts));
+	BENCH("PickUpTaggedCerts (CA, XS, CP)", 1024, sizeof(RetailCerts),
+		  PickUpTaggedCerts((signed_blob*)title.certs, sizeof(RetailCerts), certs));
+
+	// Worst case: every shared content is at the very end of content.map.
+	SharedContent* map = ArenaAlloc(sizeof(SharedContent) * BENCH_MAP_ENTRIES);
+	FillBuffer((unsigned char*)map, sizeof(SharedContent) * BENCH_MAP_ENTRIES);
+	for (int i = 0, j = BENCH_MAP_ENTRIES - 1; i < BENCH_TMD_CONTENTS; i++) {
+		if (title.tmd->contents[i].type & 0x8000)
+			memcpy(map[j--].hash, title.tmd->contents[i].hash, sizeof(sha1));
+	}
+
+	SharedContentLookup lookup;
+	BENCH("content.map lookup", 256, sizeof(SharedContent) * BENCH_MAP_ENTRIES,
+		  lookup = (SharedContentLookup){ title.tmd }; MatchSharedContents(&lookup, map, BENCH_MAP_ENTRIES));
+
+	// curl hands over at most 16KB at a time.
+	static unsigned char chunk[0x4000];
+	size_t blobmark = ArenaMark();
+	BENCH("WriteToBlob, 256KB in 16KB chunks", 64, 0x40000,
+		  blob b = {};
+		  for (int j = 0; j < 0x40000 / sizeof(chunk); j++) WriteToBlob(chunk, 1, sizeof(chunk), &b);
+		  ArenaRelease(blobmark));
+
+	// Each Fakesign is a search, so this is a lot noisier than the rest.
+	BENCH("Fakesign", 4, 0, title.ticket->reserved[0] = _i; Fakesign(&title));
+
+	ArenaRelease(mark);
+}
+
+static void BenchContentAES(unsigned char* in, unsigned char* out, size_t size) {
+	mbedtls_aes_context aes = {};
+	TitleCrypto crypto = {};
+	aesiv iv = {};
+
+	memcpy(crypto.key, BenchKey, sizeof(aeskey));
+
+	mbedtls_aes_setkey_enc(&aes, BenchKey, 128);
+	BENCH("mbedtls AES-CBC encrypt", BENCH_ITERATIONS, size,
+		  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, size, iv.full, in, out));
+
+	mbedtls_aes_setkey_dec(&aes, BenchKey, 128);
+	BENCH("mbedtls AES-CBC decrypt", BENCH_ITERATIONS, size,
+		  mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, size, iv.full, in, out));
+
+	BENCH("AESCryptCBC encrypt", BENCH_ITERATIONS, size,
+		  AESCryptCBC(&crypto, MBEDTLS_AES_ENCRYPT, size, iv.full, in, out));
+}
+
+static void BenchCryptAndHash(unsigned char* in, unsigned char* out, size_t size) {
+	mbedtls_aes_context aes = {};
+	mbedtls_sha1_context sha = {};
+	aesiv iv = {};
+	sha1 hash;
+	u64 start;
+
+	mbedtls_aes_setkey_dec(&aes, BenchKey, 128);
+
+	start = gettime();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		iv = (aesiv){};
+		mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, size, iv.full, in, out);
+		mbedtls_sha1_ret(out, size, hash);
+	}
+	Report("AES-CBC decrypt, then SHA-1", gettime() - start, BENCH_ITERATIONS, size);
+
+	start = gettime();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		iv = (aesiv){};
+		mbedtls_sha1_init(&sha);
+		mbedtls_sha1_starts_ret(&sha);
+		CryptAndHash(&aes, MBEDTLS_AES_DECRYPT, size, size, iv.full, in, out, &sha);
+		mbedtls_sha1_finish_ret(&sha, hash);
+	}
+	Report("CryptAndHash (decrypt)", gettime() - start, BENCH_ITERATIONS, size);
+
+	mbedtls_aes_setkey_enc(&aes, BenchKey, 128);
+
+	start = gettime();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		iv = (aesiv){};
+		mbedtls_sha1_ret(in, size, hash);
+		mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, size, iv.full, in, out);
+	}
+	Report("SHA-1, then AES-CBC encrypt", gettime() - start, BENCH_ITERATIONS, size);
+
+	start = gettime();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		iv = (aesiv){};
+		mbedtls_sha1_init(&sha);
+		mbedtls_sha1_starts_ret(&sha);
+		CryptAndHash(&aes, MBEDTLS_AES_ENCRYPT, size, size, iv.full, in, out, &sha);
+		mbedtls_sha1_finish_ret(&sha, hash);
+	}
+	Report("CryptAndHash (encrypt)", gettime() - start, BENCH_ITERATIONS, size);
+}
+
+static void BenchCryptoBackends(unsigned char* in, unsigned char* out, size_t maxsize) {
+	size_t threshold = CryptoHardwareThreshold, crossover = 0;
+	TitleCrypto crypto = {};
+	HashContext sha;
+	sha1 hash;
+	char name[64];
+
+	if (!CryptoHardwareAvailable()) {
+		puts("No /dev/aes or /dev/sha, skipping the hardware benchmarks.");
+		return;
+	}
+
+	memcpy(crypto.key, BenchKey, sizeof(aeskey));
+	for (size_t size = 0x40; size <= maxsize; size <<= 2) {
+		u64 ticks[2];
+		sha1 hashes[2];
+		aesiv ivs[2];
+
+		for (int hw = 0; hw < 2; hw++) {
+			aesiv iv = {};
+			CryptoHardwareThreshold = hw ? 0 : SIZE_MAX;
+
+			u64 start = gettime();
+			for (int i = 0; i < BENCH_ITERATIONS; i++) {
+				AESCryptCBC(&crypto, MBEDTLS_AES_ENCRYPT, size, iv.full, in, out);
+				HashInit(&sha, size);
+				HashUpdate(&sha, in, size);
+				HashFinish(&sha, hash);
+			}
+			ticks[hw] = gettime() - start;
+			memcpy(hashes[hw], hash, sizeof(sha1));
+			ivs[hw] = iv;
+
+			sprintf(name, "AES+SHA-1 %6zu bytes (%s)", size, hw ? "IOS" : "PPC");
+			Report(name, ticks[hw], BENCH_ITERATIONS, size);
+		}
+
+		// The IV is the last block of ciphertext, so that covers the AES side.
+		if (memcmp(hashes[0], hashes[1], sizeof(sha1)) || memcmp(ivs[0].full, ivs[1].full, sizeof(aeskey)))
+			printf("The IOS engines got a different answer at %zu bytes!\n", size);
+
+		if (!crossover && ticks[1] < ticks[0])
+			crossover = size;
+	}
+
+	CryptoHardwareThreshold = threshold;
+	if (crossover)
+		printf("The IOS engines win from about %zu bytes on. (threshold is %zu)\n", crossover, threshold);
+	else
+		puts("The IOS engines never won?");
+}
+
+#ifdef BENCH_SERVER
+#define BENCH_DOWNLOAD_SIZE (8 << 20)
+
+static size_t DiscardData(void* buffer, size_t size, size_t nmemb, void* userp) {
+	return size * nmemb;
+}
+
+static int DiscardWindow(unsigned char* data, size_t length, void* userp) {
+	return 0;
+}
+
+// One big file from the stand-in, over one connection and then split over several.
+void BenchDownloads(const char* server) {
+	char url[128];
+	unsigned char* buffer = ArenaGetBuffer();
+	int ret;
+
+	if (!buffer) {
+		puts("BenchDownloads: no I/O buffer?");
+		return;
+	}
+
+	sprintf(url, "%s/blob/%u", server, BENCH_DOWNLOAD_SIZE);
+
+	u64 start = gettime();
+	ret = DownloadFile(url, DOWNLOAD_CUSTOM, DiscardData, NULL);
+	if (ret < 0)
+		printf("Single stream failed! (%i, %s)\n", ret, GetLastDownloadError());
+	else
+		Report("download, 1 stream", gettime() - start, 1, BENCH_DOWNLOAD_SIZE);
+
+	for (unsigned segments = 2; segments <= 8; segments *= 2) {
+		char name[32];
+
+		start = gettime();
+		ret = DownloadFileSegmented(url, BENCH_DOWNLOAD_SIZE, segments, buffer, ArenaBufferSize(), DiscardWindow, NULL);
+		sprintf(name, "download, %u segments", segments);
+		if (ret < 0)
+			printf("%s failed! (%i, %s)\n", name, ret, GetLastDownloadError());
+		else
+			Report(name, gettime() - start, 1, BENCH_DOWNLOAD_SIZE);
+	}
+
+	ArenaPutBuffer(buffer);
+}
+#endif
+
+void RunBenchmarks(void) {
+	unsigned char* in  = ArenaGetBuffer();
+	unsigned char* out = ArenaGetBuffer();
+	size_t size = ArenaBufferSize();
+
+	if (!in || !out) {
+		puts("RunBenchmarks: no I/O buffers?");
+		goto finish;
+	}
+
+	printf("Benchmarking with %zu KB buffers, %u iterations each.\n\n", size >> 10, BENCH_ITERATIONS);
+	FillBuffer(in, size);
+
+	BenchMetadata();
+	BenchContentAES(in, out, size);
+	BenchCryptAndHash(in, out, size);
+	BenchCryptoBackends(in, out, size);
+
+finish:
+	ArenaPutBuffer(out);
+	ArenaPutBuffer(in);
+}
+#endif
@@ -0,0 +1,7 @@
+// Build with `make BENCHMARK=1` to run these on the console instead of the restorer.
+#ifdef BENCHMARK
+void RunBenchmarks(void);
+#ifdef BENCH_SERVER
+void BenchDownloads(const char* server);
+#endif
+#endif
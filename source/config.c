@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "config.h"
+#include "log.h"
+
+static char* Trim(char* str) {
+	while (isspace((unsigned char)*str))
+		str++;
+
+	char* end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+
+	*end = 0;
+	return str;
+}
+
+static bool ParseBool(const char* value) {
+	return !strcasecmp(value, "yes") || !strcasecmp(value, "true") || !strcmp(value, "1");
+}
+
+int LoadConfig(const char* path, Config* config) {
+	char line[256];
+	int lineno = 0;
+
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	memset(config, 0, sizeof(Config));
+	strcpy(config->channels, "all");
+	strcpy(config->reports, "sd:/");
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+
+		char* comment = strchr(line, '#');
+		if (comment) *comment = 0;
+
+		char* key = Trim(line);
+		if (!*key)
+			continue;
+
+		char* value = strchr(key, '=');
+		if (!value) {
+			LogPrintf("%s:%i: expected key = value\n", path, lineno);
+			continue;
+		}
+
+		*value++ = 0;
+		key   = Trim(key);
+		value = Trim(value);
+
+		if (!strcasecmp(key, "channels"))
+			strncpy(config->channels, value, sizeof(config->channels) - 1);
+
+		else if (!strcasecmp(key, "server")) {
+			if (config->num_servers < CONFIG_MAX_SERVERS)
+				strncpy(config->servers[config->num_servers++], value, sizeof(config->servers[0]) - 1);
+		}
+
+		else if (!strcasecmp(key, "cache"))
+			strncpy(config->cache, value, sizeof(config->cache) - 1);
+
+		else if (!strcasecmp(key, "update"))
+			strncpy(config->update, value, sizeof(config->update) - 1);
+
+		else if (!strcasecmp(key, "peer"))
+			strncpy(config->peer, value, sizeof(config->peer) - 1);
+
+		else if (!strcasecmp(key, "reports")) {
+			if (*value)
+				strncpy(config->reports, value, sizeof(config->reports) - 1);
+			else
+				LogPrintf("%s:%i: reports needs a directory, keeping %s\n", path, lineno, config->reports);
+		}
+
+		else if (!strcasecmp(key, "connections"))
+			config->connections = strtoul(value, NULL, 0);
+
+		else if (!strcasecmp(key, "force"))
+			config->force = ParseBool(value);
+
+		else if (!strcasecmp(key, "purge"))
+			config->purge = ParseBool(value);
+
+		else if (!strcasecmp(key, "serve"))
+			config->serve = ParseBool(value);
+
+		else
+			LogPrintf("%s:%i: unknown option '%s'\n", path, lineno, key);
+	}
+
+	fclose(fp);
+	return 0;
+}
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+
+#define CONFIG_PATH        "sd:/restorer.ini"
+#define CONFIG_MAX_SERVERS 4
+
+/*
+ * If there's a config file on the SD card, the restorer runs without asking anything.
+ * It's `key = value`, one per line, # for comments:
+ *
+ *   channels = all                 # or "outdated", or names/title IDs, separated by commas
+ *   server   = http://10.0.0.2:8000  # NUS mirror, can be repeated. Tried in order.
+ *   force    = no                  # reinstall channels that are already up to date
+ *   purge    = no                  # delete the old title first
+ *   reports  = sd:/                # where to write <device ID>.txt
+ *   cache    = sd:/restorer-cache  # download everything here first, then install. Off if not set.
+ *   connections = 4                # per big content, 1 for one at a time
+ *   update   = <url>               # NetUpdate SOAP endpoint for "outdated"
+ *   peer     = auto                # another console serving its cache, tried before the server. Or its http://address:port
+ *   serve    = no                  # when done, serve the cache to the other consoles until HOME is pressed
+ */
+typedef struct {
+	char channels[256];
+	char servers[CONFIG_MAX_SERVERS][96];
+	int  num_servers;
+	char reports[64];
+	char cache[64];
+	char update[128];
+	char peer[96];
+	unsigned connections;
+	bool force;
+	bool purge;
+	bool serve;
+} Config;
+
+int LoadConfig(const char* path, Config* config);
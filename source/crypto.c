@@ -1,9 +1,21 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
+#include <errno.h>
+#include <ogc/aes.h>
 
 #include "crypto.h"
+#include "log.h"
+
+// Small enough that a chunk is still in the PPC's 32 KB L1 by the time it gets hashed.
+#ifndef CRYPT_HASH_CHUNK
+#define CRYPT_HASH_CHUNK 0x1000
+#endif
 
 static mbedtls_aes_context titlekeyctx[3][2];
+static bool hw_aes = false, hw_sha = false;
+
+size_t CryptoHardwareThreshold = 0x4000;
 
 __attribute__((constructor))
 void SetupCommonKeys(void) {
@@ -18,7 +30,7 @@ void GetTitleKey(tik* p_tik, aeskey out) {
 
 	uint8_t commonKeyIndex = p_tik->reserved[0xb];
 	if (commonKeyIndex > 0x02) {
-		printf("Unknown common key index!? (0x%hhx)\n", commonKeyIndex);
+		LogPrintf("Unknown common key index!? (0x%hhx)\n", commonKeyIndex);
 		commonKeyIndex = 0;
 	}
 
@@ -26,33 +38,58 @@ void GetTitleKey(tik* p_tik, aeskey out) {
 						  iv.full, p_tik->cipher_title_key, out);
 }
 
+static void WrapTitleKey(const aeskey key, tik* p_tik, uint8_t index) {
+	aesiv iv = { .titleid = p_tik->titleid };
+
+	mbedtls_aes_crypt_cbc(&titlekeyctx[index][1], MBEDTLS_AES_ENCRYPT, sizeof(aeskey),
+						  iv.full, key, p_tik->cipher_title_key);
+	p_tik->reserved[0xb] = index;
+}
+
 void ChangeCommonKey(tik* p_tik, uint8_t index) {
 	aeskey in = {};
-	aesiv  iv = { .titleid = p_tik->titleid };
 
 	if (index > 0x02)
 		return;
 
 	GetTitleKey(p_tik, in);
-	mbedtls_aes_crypt_cbc(&titlekeyctx[index][1], MBEDTLS_AES_ENCRYPT, sizeof(aeskey),
-						  iv.full, in, p_tik->cipher_title_key);
-	p_tik->reserved[0xb] = index;
+	WrapTitleKey(in, p_tik, index);
+}
+
+void TitleCryptoInit(TitleCrypto* crypto, tik* p_tik) {
+	memset(crypto, 0, sizeof(TitleCrypto));
+	GetTitleKey(p_tik, crypto->key);
+}
+
+mbedtls_aes_context* TitleCryptoSchedule(TitleCrypto* crypto, int mode) {
+	if (mode == MBEDTLS_AES_ENCRYPT) {
+		if (!crypto->have_enc)
+			mbedtls_aes_setkey_enc(&crypto->enc, crypto->key, 128);
+
+		crypto->have_enc = true;
+		return &crypto->enc;
+	}
+
+	if (!crypto->have_dec)
+		mbedtls_aes_setkey_dec(&crypto->dec, crypto->key, 128);
+
+	crypto->have_dec = true;
+	return &crypto->dec;
 }
 
-void SetupTitleContentContext(tik* p_tik, int16_t index, mbedtls_aes_context* ctx, int mode) {
-	aeskey titlekey = {};
+// Nothing to redo here, the title key doesn't change, only what it's wrapped with.
+void TitleCryptoWrap(TitleCrypto* crypto, tik* p_tik, uint8_t index) {
+	if (index > 0x02)
+		index = 0;
 
-	GetTitleKey(p_tik, titlekey);
-	(mode ? mbedtls_aes_setkey_enc : mbedtls_aes_setkey_dec)(ctx, titlekey, 128);
+	WrapTitleKey(crypto->key, p_tik, index);
 }
 
-int DecryptTitleContent(tik* p_tik, uint16_t index, void* content, size_t csize, void* out, void* iv) {
-	mbedtls_aes_context title = {};
-	aesiv                 _iv = { .index = index };
-	void              *ptr_iv = iv ?: _iv.full;
+int DecryptTitleContent(TitleCrypto* crypto, uint16_t index, void* content, size_t csize, void* out, void* iv) {
+	aesiv   _iv = ContentIV(index);
+	void* ptr_iv = iv ?: _iv.full;
 
-	SetupTitleContentContext(p_tik, index, &title, MBEDTLS_AES_DECRYPT);
-	return mbedtls_aes_crypt_cbc(&title, MBEDTLS_AES_DECRYPT, csize, ptr_iv, content, out);
+	return mbedtls_aes_crypt_cbc(TitleCryptoSchedule(crypto, MBEDTLS_AES_DECRYPT), MBEDTLS_AES_DECRYPT, csize, ptr_iv, content, out);
 }
 
 bool CheckHash(void* ptr, size_t len, sha1 expected) {
@@ -61,3 +98,144 @@ bool CheckHash(void* ptr, size_t len, sha1 expected) {
 	mbedtls_sha1_ret(ptr, len, hash);
 	return !memcmp(hash, expected, sizeof(sha1));
 }
+
+bool CheckHashFinish(HashContext* ctx, sha1 expected) {
+	sha1 hash = {};
+
+	HashFinish(ctx, hash);
+	return !memcmp(hash, expected, sizeof(sha1));
+}
+
+/*
+ * AES-CBC and SHA-1 over the same buffer in one pass, CRYPT_HASH_CHUNK bytes at a time, so each
+ * chunk is hashed while it's still in the cache. Going block by block costs more in calls than it
+ * saves. The hash is always of the plaintext, and only of the first `hashlen` bytes (i.e. not the
+ * padding on the end of a content).
+ */
+int CryptAndHash(mbedtls_aes_context* aes, int mode, size_t length, size_t hashlen, unsigned char iv[16],
+				 const unsigned char* in, unsigned char* out, mbedtls_sha1_context* sha) {
+	int ret;
+
+	if (length % 16)
+		return MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH;
+
+	if (hashlen > length)
+		hashlen = length;
+
+	for (size_t offset = 0; offset < length; offset += CRYPT_HASH_CHUNK) {
+		size_t block = MIN(length - offset, CRYPT_HASH_CHUNK);
+		size_t hashblock = (offset < hashlen) ? MIN(hashlen - offset, block) : 0;
+
+		if (mode == MBEDTLS_AES_ENCRYPT && hashblock)
+			mbedtls_sha1_update_ret(sha, in + offset, hashblock);
+
+		ret = mbedtls_aes_crypt_cbc(aes, mode, block, iv, in + offset, out + offset);
+		if (ret)
+			return ret;
+
+		if (mode == MBEDTLS_AES_DECRYPT && hashblock)
+			mbedtls_sha1_update_ret(sha, out + offset, hashblock);
+	}
+
+	return 0;
+}
+
+bool CryptoInit(void) {
+	hw_aes = AES_Init() >= 0;
+	hw_sha = SHA_Init() >= 0;
+
+	return hw_aes && hw_sha;
+}
+
+void CryptoDeinit(void) {
+	if (hw_aes) AES_Close();
+	if (hw_sha) SHA_Close();
+
+	hw_aes = hw_sha = false;
+}
+
+bool CryptoHardwareAvailable(void) {
+	return hw_aes && hw_sha;
+}
+
+int AESCryptCBC(TitleCrypto* crypto, int mode, size_t length, unsigned char iv[16], const void* in, void* out) {
+	int ret;
+
+	if (length % 16)
+		return MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH;
+
+	if (!length)
+		return 0;
+
+	if (hw_aes && length >= CryptoHardwareThreshold && __builtin_is_aligned(in, 0x20) && __builtin_is_aligned(out, 0x20)) {
+		aeskey hwkey [[gnu::aligned(0x20)]], hwiv [[gnu::aligned(0x20)]], nextiv;
+
+		memcpy(hwkey, crypto->key, sizeof(aeskey));
+		memcpy(hwiv, iv, sizeof(aeskey));
+
+		// The next IV is the last ciphertext block. Grab it before an in-place decrypt overwrites it.
+		if (mode == MBEDTLS_AES_DECRYPT)
+			memcpy(nextiv, in + length - 16, sizeof(aeskey));
+
+		if (mode == MBEDTLS_AES_ENCRYPT)
+			ret = AES_Encrypt(hwkey, sizeof(aeskey), hwiv, sizeof(aeskey), in, out, length);
+		else
+			ret = AES_Decrypt(hwkey, sizeof(aeskey), hwiv, sizeof(aeskey), in, out, length);
+
+		if (ret >= 0) {
+			memcpy(iv, (mode == MBEDTLS_AES_ENCRYPT) ? out + length - 16 : nextiv, sizeof(aeskey));
+			return 0;
+		}
+
+		// Fall back to doing it ourselves.
+	}
+
+	return mbedtls_aes_crypt_cbc(TitleCryptoSchedule(crypto, mode), mode, length, iv, in, out);
+}
+
+void HashInit(HashContext* ctx, size_t size_hint) {
+	ctx->taillen  = 0;
+	ctx->hardware = hw_sha && size_hint >= CryptoHardwareThreshold;
+
+	if (ctx->hardware) {
+		SHA_InitializeContext(&ctx->hw);
+	} else {
+		mbedtls_sha1_init(&ctx->sw);
+		mbedtls_sha1_starts_ret(&ctx->sw);
+	}
+}
+
+int HashUpdate(HashContext* ctx, const void* data, size_t length) {
+	int ret;
+
+	if (!ctx->hardware)
+		return mbedtls_sha1_update_ret(&ctx->sw, data, length);
+
+	// Only the last update can leave a partial block behind.
+	if (ctx->taillen || !__builtin_is_aligned(data, 0x40))
+		return -EINVAL;
+
+	size_t body = __builtin_align_down(length, 64);
+	if (body) {
+		ret = SHA_Input(&ctx->hw, data, body);
+		if (ret < 0)
+			return ret;
+	}
+
+	ctx->taillen = length - body;
+	memcpy(ctx->tail, data + body, ctx->taillen);
+	return 0;
+}
+
+void HashFinish(HashContext* ctx, sha1 out) {
+	sha1 hash [[gnu::aligned(0x20)]] = {};
+
+	if (!ctx->hardware) {
+		mbedtls_sha1_finish_ret(&ctx->sw, out);
+		mbedtls_sha1_free(&ctx->sw);
+		return;
+	}
+
+	SHA_Finalize(&ctx->hw, ctx->tail, ctx->taillen, hash);
+	memcpy(out, hash, sizeof(sha1));
+}
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <mbedtls/aes.h>
 #include <mbedtls/sha1.h>
+#include <ogc/sha.h>
 
 typedef union {
 	int16_t index;
@@ -11,7 +12,22 @@ typedef union {
 	int64_t part[2];
 
 	aeskey full;
-} aesiv;
+} __attribute__((scalar_storage_order("big-endian"))) aesiv; // like ES has them, also on a little-endian host
+
+// A content's IV is its index, and zeroes.
+static inline aesiv ContentIV(uint16_t index) {
+	return (aesiv){ .index = index };
+}
+
+/*
+ * A title's key, unwrapped from the ticket once, and the AES key schedules for it, each set up the first
+ * time it's asked for. It lives in struct Title, the schedules point into themselves so don't copy it around.
+ */
+typedef struct {
+	aeskey key;
+	mbedtls_aes_context enc, dec;
+	bool have_enc, have_dec;
+} TitleCrypto;
 
 static const aeskey CommonKeys[3] = {
 	/* Standard common key */	{ 0xeb, 0xe4, 0x2a, 0x22, 0x5e, 0x85, 0x93, 0xe4, 0x48, 0xd9, 0xc5, 0x45, 0x73, 0x81, 0xaa, 0xf7 },
@@ -19,7 +35,38 @@ static const aeskey CommonKeys[3] = {
 	/*   vWii common key   */	{ 0x30, 0xbf, 0xc7, 0x6e, 0x7c, 0x19, 0xaf, 0xbb, 0x23, 0x16, 0x33, 0x30, 0xce, 0xd7, 0xc2, 0x8d },
 };
 
+/*
+ * SHA-1 that runs on either mbedtls or Starlet's SHA engine (/dev/sha), picked once in HashInit() from
+ * the expected size. On the hardware path every update except the last must be a multiple of 64 bytes,
+ * and the data must be 64-byte aligned (i.e. the arena's I/O buffers).
+ */
+typedef struct HashContext {
+	sha_context hw __attribute__((aligned(0x40)));
+	unsigned char tail[64] __attribute__((aligned(0x40)));
+	uint32_t taillen;
+
+	mbedtls_sha1_context sw;
+	bool hardware;
+} HashContext;
+
+// Buffers smaller than this stay on the PPC, the IPC round trip isn't worth it.
+extern size_t CryptoHardwareThreshold;
+
+bool CryptoInit(void);
+void CryptoDeinit(void);
+bool CryptoHardwareAvailable(void);
+int  AESCryptCBC(TitleCrypto*, int mode, size_t length, unsigned char iv[16], const void* in, void* out);
+void HashInit(HashContext*, size_t size_hint);
+int  HashUpdate(HashContext*, const void* data, size_t length);
+void HashFinish(HashContext*, sha1 out);
+
 void GetTitleKey(tik*, aeskey);
 void ChangeCommonKey(tik*, uint8_t);
-int DecryptTitleContent(tik* p_tik, uint16_t index, void* content, size_t csize, void* out, void* iv);
-bool CheckHash(void*, size_t, sha1);
\ No newline at end of file
+void TitleCryptoInit(TitleCrypto*, tik*);
+mbedtls_aes_context* TitleCryptoSchedule(TitleCrypto*, int mode);
+void TitleCryptoWrap(TitleCrypto*, tik*, uint8_t common_key); // the key back into the ticket, for its (new) title ID
+int DecryptTitleContent(TitleCrypto*, uint16_t index, void* content, size_t csize, void* out, void* iv);
+bool CheckHash(void*, size_t, sha1);
+bool CheckHashFinish(HashContext*, sha1);
+int CryptAndHash(mbedtls_aes_context*, int mode, size_t length, size_t hashlen, unsigned char iv[16],
+				 const unsigned char* in, unsigned char* out, mbedtls_sha1_context*);
\ No newline at end of file
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ogc/lwp.h>
+#include <ogc/mutex.h>
+#include <ogc/semaphore.h>
+
+#include "engine.h"
+#include "arena.h"
+#include "nus.h"
+#include "verify.h"
+#include "network.h"
+#include "log.h"
+
+#define ENGINE_MAX_EVENTS 64
+#define ENGINE_STACK_SIZE 0x10000
+
+static lwp_t thread = LWP_THREAD_NULL;
+static mutex_t lock;
+static sem_t wake;
+static bool quit;
+
+static EngineCallback callback;
+static void* callback_userp;
+
+// All under lock.
+static Job* queue = NULL;
+static Job* current = NULL;
+static Job* finished = NULL;
+static int pending = 0;
+static EngineEvent events[ENGINE_MAX_EVENTS];
+static unsigned first_event = 0, num_events = 0, dropped = 0;
+static EngineEvent progress;
+static bool have_progress = false;
+
+static void Append(Job** list, Job* job) {
+	job->next = NULL;
+	while (*list)
+		list = &(*list)->next;
+
+	*list = job;
+}
+
+static void PushEvent(const EngineEvent* event) {
+	if (num_events == ENGINE_MAX_EVENTS) {
+		dropped++;
+		return;
+	}
+
+	events[(first_event + num_events++) % ENGINE_MAX_EVENTS] = *event;
+}
+
+static void LogToEvents(const char* text, void* userp) {
+	EngineEvent event = { ENGINE_LOG, current };
+
+	strncpy(event.text, text, sizeof(event.text) - 1);
+
+	LWP_MutexLock(lock);
+	// Keep it in order with the lines around it.
+	if (have_progress) {
+		PushEvent(&progress);
+		have_progress = false;
+	}
+	PushEvent(&event);
+	LWP_MutexUnlock(lock);
+}
+
+// Only the latest one matters, so these never fill up the ring.
+static void ProgressToEvents(uint64_t now, uint64_t total, uint32_t elapsed, void* userp) {
+	LWP_MutexLock(lock);
+	progress = (EngineEvent){ ENGINE_PROGRESS, current, "", now, total, elapsed };
+	have_progress = true;
+	LWP_MutexUnlock(lock);
+}
+
+static int RunJob(Job* job) {
+	int ret;
+	struct Title local = {}, remote = {};
+	size_t mark = ArenaMark();
+
+	switch (job->type) {
+		case JOB_RESOLVE:
+			ret = GetInstalledTitleTier(job->titleID, TITLE_VIEW, &local);
+			job->is_installed = (ret == 0);
+			if (job->is_installed)
+				job->installed = TitleVersion(&local);
+
+			ret = DownloadTitleMeta(job->titleID, job->revision, &remote);
+			if (ret == 0) {
+				job->latest = remote.tmd->title_version;
+				FreeTitle(&remote);
+			}
+			FreeTitle(&local);
+			break;
+
+		case JOB_DOWNLOAD:
+		case JOB_INSTALL:
+			if (job->type == JOB_DOWNLOAD && !job->cache) {
+				ret = -EINVAL;
+				break;
+			}
+
+			SetStaging(job->type == JOB_DOWNLOAD ? STAGING_DOWNLOAD : (job->cache ? STAGING_INSTALL : STAGING_OFF), job->cache);
+			ret = DownloadTitleMeta(job->titleID, job->revision, &remote);
+			if (ret == 0) {
+				ret = InstallTitle(&remote, job->purge);
+				FreeTitle(&remote);
+			}
+			SetStaging(STAGING_OFF, NULL);
+			break;
+
+		case JOB_VERIFY:
+			ret = job->verify ? VerifyTitle(job->titleID, job->verify) : -EINVAL;
+			break;
+
+		case JOB_CALL:
+			ret = job->call ? job->call(job->arg) : -EINVAL;
+			break;
+
+		default:
+			ret = -EINVAL;
+			break;
+	}
+
+	ArenaRelease(mark);
+	return ret;
+}
+
+static void* EngineThread(void* arg) {
+	for (;;) {
+		LWP_SemWait(wake);
+
+		LWP_MutexLock(lock);
+		Job* job = queue;
+		if (job) {
+			queue = job->next;
+			current = job;
+			job->state = JOB_RUNNING;
+			DownloadCancel = false;
+		}
+		bool stop = quit && !queue;
+		LWP_MutexUnlock(lock);
+
+		if (job) {
+			ArenaClaim(true);
+			SetLogHandler(LogToEvents, NULL);
+			SetDownloadProgress(ProgressToEvents, NULL);
+			int ret = RunJob(job);
+			SetDownloadProgress(NULL, NULL);
+			SetLogHandler(NULL, NULL);
+			ArenaClaim(false);
+
+			LWP_MutexLock(lock);
+			job->result = ret;
+			job->state  = (ret < 0 && DownloadCancel) ? JOB_CANCELLED : JOB_DONE;
+			current = NULL;
+			Append(&finished, job);
+			LWP_MutexUnlock(lock);
+		}
+
+		if (stop)
+			break;
+	}
+
+	return NULL;
+}
+
+int EngineStart(EngineCallback cb, void* userp) {
+	int ret;
+
+	if (thread != LWP_THREAD_NULL)
+		return -EBUSY;
+
+	callback       = cb;
+	callback_userp = userp;
+	quit           = false;
+
+	LWP_MutexInit(&lock, false);
+	LWP_SemInit(&wake, 0, 0x7FFFFFFF);
+
+	ret = LWP_CreateThread(&thread, EngineThread, NULL, NULL, ENGINE_STACK_SIZE, 50);
+	if (ret < 0) {
+		thread = LWP_THREAD_NULL;
+		LWP_SemDestroy(wake);
+		LWP_MutexDestroy(lock);
+		return ret;
+	}
+
+	return 0;
+}
+
+void EngineStop(void) {
+	if (thread == LWP_THREAD_NULL)
+		return;
+
+	LWP_MutexLock(lock);
+	quit = true;
+	while (queue) {
+		Job* job = queue;
+		queue = job->next;
+		job->state  = JOB_CANCELLED;
+		job->result = -ECANCELED;
+		Append(&finished, job);
+	}
+	if (current)
+		DownloadCancel = true;
+	LWP_MutexUnlock(lock);
+
+	LWP_SemPost(wake);
+	LWP_JoinThread(thread, NULL);
+	EnginePump();
+	thread = LWP_THREAD_NULL;
+
+	LWP_SemDestroy(wake);
+	LWP_MutexDestroy(lock);
+}
+
+int EngineSubmit(Job* job) {
+	if (thread == LWP_THREAD_NULL)
+		return -ENODEV;
+
+	job->state  = JOB_QUEUED;
+	job->result = 0;
+
+	LWP_MutexLock(lock);
+	Append(&queue, job);
+	pending++;
+	LWP_MutexUnlock(lock);
+
+	LWP_SemPost(wake);
+	return 0;
+}
+
+// A queued job never starts. The running one gets its download pulled out from under it, and fails from there.
+void EngineCancel(Job* job) {
+	LWP_MutexLock(lock);
+	if (job == current) {
+		DownloadCancel = true;
+	}
+	else {
+		for (Job** link = &queue; *link; link = &(*link)->next) {
+			if (*link != job)
+				continue;
+
+			*link = job->next;
+			job->state  = JOB_CANCELLED;
+			job->result = -ECANCELED;
+			Append(&finished, job);
+			break;
+		}
+	}
+	LWP_MutexUnlock(lock);
+}
+
+static void Deliver(const EngineEvent* event) {
+	if (callback)
+		callback(event, callback_userp);
+	else if (event->type == ENGINE_LOG)
+		fputs(event->text, stdout);
+}
+
+int EnginePump(void) {
+	static EngineEvent out[ENGINE_MAX_EVENTS + 1];
+	unsigned count = 0, lost;
+	Job* done;
+
+	if (thread == LWP_THREAD_NULL)
+		return 0;
+
+	LWP_MutexLock(lock);
+	while (num_events) {
+		out[count++] = events[first_event];
+		first_event = (first_event + 1) % ENGINE_MAX_EVENTS;
+		num_events--;
+	}
+	if (have_progress) {
+		out[count++] = progress;
+		have_progress = false;
+	}
+	lost = dropped;
+	dropped = 0;
+	done = finished;
+	finished = NULL;
+	LWP_MutexUnlock(lock);
+
+	for (unsigned i = 0; i < count; i++)
+		Deliver(&out[i]);
+
+	if (lost) {
+		EngineEvent event = { ENGINE_LOG };
+		snprintf(event.text, sizeof(event.text), "\t>> (%u more lines, that was too quick to show)\n", lost);
+		Deliver(&event);
+	}
+
+	while (done) {
+		Job* job = done;
+		done = job->next;
+		job->next = NULL;
+
+		Deliver(&(EngineEvent){ ENGINE_FINISHED, job });
+		if (job->done)
+			job->done(job, job->userp);
+
+		LWP_MutexLock(lock);
+		pending--;
+		LWP_MutexUnlock(lock);
+	}
+
+	return pending;
+}
+
+// Not while the engine thread is busy, there's only one of everything underneath.
+int EngineRun(Job* job) {
+	job->state  = JOB_RUNNING;
+	job->result = RunJob(job);
+	job->state  = JOB_DONE;
+
+	if (job->done)
+		job->done(job, job->userp);
+
+	return job->result;
+}
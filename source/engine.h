@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The restore logic (nus.c and friends) as jobs, run one after the other on a thread of their own.
+ * Whatever they'd have printed and their download progress come back as events instead, and
+ * EnginePump hands those and the finished jobs over on the thread that calls it, so a front end
+ * only ever has to draw. Nothing else may touch the arena, ES or the staging cache while a job runs.
+ */
+
+typedef enum {
+	JOB_RESOLVE,  // what's installed and what's the latest, no downloading contents
+	JOB_DOWNLOAD, // the title, into cache (STAGING_DOWNLOAD)
+	JOB_VERIFY,   // VerifyTitle
+	JOB_INSTALL,  // the title, from cache if there is one
+	JOB_CALL,     // call(arg), for anything the above don't cover
+} JobType;
+
+typedef enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_CANCELLED,
+} JobState;
+
+typedef struct Job Job;
+typedef void (*JobCallback)(Job* job, void* userp);
+
+struct Job {
+	JobType type;
+	int64_t titleID;
+	int revision;      // -1 for the latest
+	bool purge;
+	const char* cache; // staging directory, or NULL
+	int (*call)(void* arg);
+	void* arg;
+	struct VerifyResult* verify; // JOB_VERIFY fills this in
+
+	JobCallback done; // on the EnginePump thread
+	void* userp;
+
+	// Filled in by the engine
+	volatile JobState state;
+	int result;
+	bool is_installed;
+	uint16_t installed; // JOB_RESOLVE
+	uint16_t latest;
+
+	Job* next;
+};
+
+typedef enum {
+	ENGINE_LOG,      // text, the same as it would've been printed
+	ENGINE_PROGRESS, // now/total bytes of the current download
+	ENGINE_FINISHED, // job is done (or cancelled), right before its done callback
+} EngineEventType;
+
+typedef struct {
+	EngineEventType type;
+	Job* job;
+	char text[128];
+	uint64_t now, total;
+	uint32_t elapsed; // ms
+} EngineEvent;
+
+typedef void (*EngineCallback)(const EngineEvent* event, void* userp);
+
+int  EngineStart(EngineCallback cb, void* userp);
+void EngineStop(void); // cancels whatever's left
+int  EngineSubmit(Job* job); // job has to stay around until it's finished
+void EngineCancel(Job* job);
+int  EnginePump(void); // delivers events, returns how many jobs are queued or running
+int  EngineRun(Job* job); // right here on this thread, printing as usual
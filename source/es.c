@@ -1,9 +1,209 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "es.h"
-#include "malloc.h"
+#include "arena.h"
+#include "nand.h"
+#include "trace.h"
+
+static int NativeAddTicket(const signed_blob* tik, uint32_t tik_size, const signed_blob* certs, uint32_t certs_size) {
+	return ES_AddTicket(tik, tik_size, certs, certs_size, NULL, 0);
+}
+
+static int NativeAddTitleStart(const signed_blob* tmd, uint32_t tmd_size, const signed_blob* certs, uint32_t certs_size) {
+	return ES_AddTitleStart(tmd, tmd_size, certs, certs_size, NULL, 0);
+}
+
+static int NativeAddContentStart(uint64_t titleID, uint32_t cid) { return ES_AddContentStart(titleID, cid); }
+static int NativeAddContentData(int cfd, void* data, uint32_t size) { return ES_AddContentData(cfd, data, size); }
+static int NativeAddContentFinish(int cfd) { return ES_AddContentFinish(cfd); }
+static int NativeAddTitleFinish(void) { return ES_AddTitleFinish(); }
+static int NativeAddTitleCancel(void) { return ES_AddTitleCancel(); }
+static int NativeDeleteTitle(uint64_t titleID) { return ES_DeleteTitle(titleID); }
+static int NativeDeleteTitleContent(uint64_t titleID) { return ES_DeleteTitleContent(titleID); }
+static int NativeDeleteTicket(const tikview* view) { return ES_DeleteTicket(view); }
+
+const ESBackend ESNative = {
+	.name               = "ES",
+	.AddTicket          = NativeAddTicket,
+	.AddTitleStart      = NativeAddTitleStart,
+	.AddContentStart    = NativeAddContentStart,
+	.AddContentData     = NativeAddContentData,
+	.AddContentFinish   = NativeAddContentFinish,
+	.AddTitleFinish     = NativeAddTitleFinish,
+	.AddTitleCancel     = NativeAddTitleCancel,
+	.DeleteTitle        = NativeDeleteTitle,
+	.DeleteTitleContent = NativeDeleteTitleContent,
+	.DeleteTicket       = NativeDeleteTicket,
+};
+
+const ESBackend* ES = &ESNative;
+
+unsigned ESEmulatedThroughput = 0;
+
+static int emu_cfd = -1;
+
+typedef enum {
+	EMU_ADDTICKET,
+	EMU_ADDTITLESTART,
+	EMU_ADDCONTENTSTART,
+	EMU_ADDCONTENTDATA,
+	EMU_ADDCONTENTFINISH,
+	EMU_ADDTITLEFINISH,
+	EMU_DELETETITLE,
+	EMU_DELETECONTENT,
+
+	EMU_CALLS
+} EmulatedCall;
+
+static const char* EmulatedCallNames[EMU_CALLS] = {
+	[EMU_ADDTICKET]        = "ES_AddTicket",
+	[EMU_ADDTITLESTART]    = "ES_AddTitleStart",
+	[EMU_ADDCONTENTSTART]  = "ES_AddContentStart",
+	[EMU_ADDCONTENTDATA]   = "ES_AddContentData",
+	[EMU_ADDCONTENTFINISH] = "ES_AddContentFinish",
+	[EMU_ADDTITLEFINISH]   = "ES_AddTitleFinish",
+	[EMU_DELETETITLE]      = "ES_DeleteTitle",
+	[EMU_DELETECONTENT]    = "ES_DeleteTitleContent",
+};
+
+// Recorded latencies (us) for each call, played back in order. See ESEmulatedReplay().
+static struct {
+	uint32_t* usecs;
+	uint32_t count, next;
+} replay[EMU_CALLS];
+
+static bool EmulatedDelay(EmulatedCall call) {
+	if (replay[call].next >= replay[call].count)
+		return false;
+
+	usleep(replay[call].usecs[replay[call].next++]);
+	return true;
+}
+
+/*
+ * Takes the ES calls out of a session trace (see trace.h), so the emulated backend takes as long as the
+ * console that recorded it did. Allocates from the arena. Pass NULL to go back to ESEmulatedThroughput.
+ */
+int ESEmulatedReplay(const char* trace, size_t length) {
+	memset(replay, 0, sizeof(replay));
+	if (!trace)
+		return 0;
+
+	// Count first, then fill in.
+	for (int pass = 0; pass < 2; pass++) {
+		for (const char* line = trace; line < trace + length;) {
+			const char* end = memchr(line, '\n', trace + length - line) ?: trace + length;
+			char call[32];
+			unsigned when, usecs;
+
+			if (sscanf(line, "I %u %u %31s", &when, &usecs, call) == 3) {
+				for (EmulatedCall i = 0; i < EMU_CALLS; i++) {
+					if (strcmp(call, EmulatedCallNames[i]))
+						continue;
+
+					if (pass)
+						replay[i].usecs[replay[i].next++] = usecs;
+					else
+						replay[i].count++;
+				}
+			}
+
+			line = end + 1;
+		}
+
+		if (pass)
+			break;
+
+		for (EmulatedCall i = 0; i < EMU_CALLS; i++) {
+			if (!replay[i].count)
+				continue;
+
+			replay[i].usecs = ArenaAlloc(replay[i].count * sizeof(uint32_t));
+			if (!replay[i].usecs) {
+				memset(replay, 0, sizeof(replay));
+				return -ENOMEM;
+			}
+		}
+	}
+
+	int total = 0;
+	for (EmulatedCall i = 0; i < EMU_CALLS; i++) {
+		replay[i].next = 0;
+		total += replay[i].count;
+	}
+
+	return total;
+}
+
+static int EmulatedAddTicket(const signed_blob* tik, uint32_t tik_size, const signed_blob* certs, uint32_t certs_size) {
+	EmulatedDelay(EMU_ADDTICKET);
+	return (tik && tik_size && certs) ? 0 : -EINVAL;
+}
+
+static int EmulatedAddTitleStart(const signed_blob* tmd, uint32_t tmd_size, const signed_blob* certs, uint32_t certs_size) {
+	EmulatedDelay(EMU_ADDTITLESTART);
+	return (tmd && tmd_size && certs) ? 0 : -EINVAL;
+}
+
+static int EmulatedAddContentStart(uint64_t titleID, uint32_t cid) {
+	EmulatedDelay(EMU_ADDCONTENTSTART);
+	return emu_cfd = 1;
+}
+
+static int EmulatedAddContentData(int cfd, void* data, uint32_t size) {
+	if (cfd != emu_cfd || !__builtin_is_aligned(data, 0x20))
+		return -EINVAL;
+
+	if (!EmulatedDelay(EMU_ADDCONTENTDATA) && ESEmulatedThroughput)
+		usleep(((uint64_t)size * 1000) / ESEmulatedThroughput);
+
+	return 0;
+}
+
+static int EmulatedAddContentFinish(int cfd) {
+	if (cfd != emu_cfd)
+		return -EINVAL;
+
+	EmulatedDelay(EMU_ADDCONTENTFINISH);
+	emu_cfd = -1;
+	return 0;
+}
+
+static int EmulatedAddTitleFinish(void) {
+	EmulatedDelay(EMU_ADDTITLEFINISH);
+	return 0;
+}
+
+static int EmulatedDeleteTitle(uint64_t titleID) {
+	EmulatedDelay(EMU_DELETETITLE);
+	return 0;
+}
+
+static int EmulatedDeleteTitleContent(uint64_t titleID) {
+	EmulatedDelay(EMU_DELETECONTENT);
+	return 0;
+}
+
+static int EmulatedNothing(void) { return 0; }
+static int EmulatedDeleteTicket(const tikview* view) { return 0; }
+
+const ESBackend ESEmulated = {
+	.name               = "emulated ES",
+	.AddTicket          = EmulatedAddTicket,
+	.AddTitleStart      = EmulatedAddTitleStart,
+	.AddContentStart    = EmulatedAddContentStart,
+	.AddContentData     = EmulatedAddContentData,
+	.AddContentFinish   = EmulatedAddContentFinish,
+	.AddTitleFinish     = EmulatedAddTitleFinish,
+	.AddTitleCancel     = EmulatedNothing,
+	.DeleteTitle        = EmulatedDeleteTitle,
+	.DeleteTitleContent = EmulatedDeleteTitleContent,
+	.DeleteTicket       = EmulatedDeleteTicket,
+};
 
 int GetStoredTMD(uint64_t titleID, signed_blob** outbuf, uint32_t* outlen) {
 	signed_blob* buffer = NULL;
@@ -13,13 +213,14 @@ int GetStoredTMD(uint64_t titleID, signed_blob** outbuf, uint32_t* outlen) {
 	if (ret < 0)
 		return ret;
 
-	buffer = memalign32(size);
+	size_t mark = ArenaMark();
+	buffer = ArenaAlloc(size);
 	if (!buffer)
         return -ENOMEM;
 
 	ret = ES_GetStoredTMD(titleID, buffer, size);
 	if (ret < 0) {
-		free(buffer);
+		ArenaRelease(mark);
 		return ret;
     }
 
@@ -32,9 +233,9 @@ int GetStoredTMD(uint64_t titleID, signed_blob** outbuf, uint32_t* outlen) {
 int PickUpTaggedCerts(const signed_blob* certs, size_t len, RetailCerts* out) {
 	while (certs && certs < (signed_blob*)(((void*)certs) + len)) {
 		cert_header* cert = SIGNATURE_PAYLOAD(certs);
-		uint16_t certid = *(uint16_t*)cert->cert_name;
+		uint16_t certid = (uint8_t)cert->cert_name[0] << 8 | (uint8_t)cert->cert_name[1];
 
-		switch (certs[0]) {
+		switch (((sig_rsa2048*)certs)->type) {
 			case ES_SIG_RSA4096:
 				if (cert->cert_type == 0x00000001 && certid == 0x4341) {
 					memcpy(&out->CA, certs, sizeof(out->CA));
@@ -64,3 +265,33 @@ int PickUpTaggedCerts(const signed_blob* certs, size_t len, RetailCerts* out) {
 
 	return 0;
 }
+
+void MatchSharedContents(SharedContentLookup* lookup, const SharedContent* entries, uint32_t count) {
+	for (int i = 0; i < lookup->tmd->num_contents; i++) {
+		tmd_content* content = lookup->tmd->contents + i;
+
+		if (!(content->type & 0x8000) || SharedContentFound(lookup, i))
+			continue;
+
+		for (const SharedContent* s_content = entries; s_content < entries + count; s_content++) {
+			if (memcmp(s_content->hash, content->hash, sizeof(sha1)) == 0) {
+				lookup->found[i / 32] |= 1 << (i % 32);
+				if (lookup->names)
+					memcpy(lookup->names[i], s_content->name, sizeof(s_content->name));
+
+				break;
+			}
+		}
+	}
+}
+
+static int FindSharedContents(unsigned char* chunk, uint32_t length, uint32_t offset, void* userp) {
+	MatchSharedContents(userp, (SharedContent*)chunk, length / sizeof(SharedContent));
+	return 0;
+}
+
+int LookupSharedContents(SharedContentLookup* lookup) {
+	// Chunks have to hold whole entries.
+	return NANDStreamFile("/shared1/content.map", (ArenaBufferSize() / sizeof(SharedContent)) * sizeof(SharedContent),
+						  FindSharedContents, lookup);
+}
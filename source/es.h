@@ -23,6 +23,47 @@ typedef struct RetailCerts {
 
 _Static_assert(sizeof(RetailCerts) == 0xA00, "I can't believe it's not cert.sys");
 
+/*
+ * Everything that writes to the NAND through ES goes through one of these,
+ * so it can be swapped out for something that doesn't (benchmarks, dry runs).
+ */
+typedef struct ESBackend {
+	const char* name;
+
+	int (*AddTicket)(const signed_blob* tik, uint32_t tik_size, const signed_blob* certs, uint32_t certs_size);
+	int (*AddTitleStart)(const signed_blob* tmd, uint32_t tmd_size, const signed_blob* certs, uint32_t certs_size);
+	int (*AddContentStart)(uint64_t titleID, uint32_t cid);
+	int (*AddContentData)(int cfd, void* data, uint32_t size);
+	int (*AddContentFinish)(int cfd);
+	int (*AddTitleFinish)(void);
+	int (*AddTitleCancel)(void);
+	int (*DeleteTitle)(uint64_t titleID);
+	int (*DeleteTitleContent)(uint64_t titleID);
+	int (*DeleteTicket)(const tikview* view);
+} ESBackend;
+
+extern const ESBackend ESNative, ESEmulated;
+extern const ESBackend* ES;
+
+// KB/s that the emulated backend pretends to write at, 0 for as fast as possible.
+extern unsigned ESEmulatedThroughput;
+int ESEmulatedReplay(const char* trace, size_t length);
+
+typedef struct {
+	char name[8];
+	sha1 hash;
+} SharedContent;
+
+typedef struct {
+	tmd* tmd;
+	uint32_t found[MAX_NUM_TMD_CONTENTS / 32];
+	char (*names)[8]; // optional, one per TMD content
+} SharedContentLookup;
+
+#define SharedContentFound(lookup, i) ((lookup)->found[(i) / 32] & (1 << ((i) % 32)))
+
 int GetStoredTMD(uint64_t titleID, signed_blob** outbuf, uint32_t* outlen);
 int PickUpTaggedCerts(const signed_blob*, size_t len, RetailCerts*);
+void MatchSharedContents(SharedContentLookup*, const SharedContent* entries, uint32_t count);
+int LookupSharedContents(SharedContentLookup*);
 
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "log.h"
+
+#define JOURNAL_MAX_ENTRIES 512
+
+typedef struct {
+	char type;
+	int64_t titleID;
+	uint32_t value; // content ID, or the version for F
+	char name[12];
+	unsigned char hash[20];
+} JournalEntry;
+
+static char journal_path[64];
+static FILE* journal = NULL;
+static JournalEntry entries[JOURNAL_MAX_ENTRIES];
+static int num_entries = 0;
+
+static JournalEntry* Find(const JournalEntry* match) {
+	for (JournalEntry* entry = entries; entry < entries + num_entries; entry++) {
+		if (entry->type == match->type && entry->titleID == match->titleID && entry->value == match->value
+		&& !strcmp(entry->name, match->name) && !memcmp(entry->hash, match->hash, sizeof(entry->hash)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static bool Remember(const JournalEntry* entry) {
+	if (Find(entry) || num_entries == JOURNAL_MAX_ENTRIES)
+		return false;
+
+	entries[num_entries++] = *entry;
+	return true;
+}
+
+// A line cut off by a power cut just doesn't parse.
+static bool ParseLine(const char* line, JournalEntry* entry) {
+	char hash[41];
+	unsigned long long tid;
+	int len = 0;
+
+	memset(entry, 0, sizeof(JournalEntry));
+	entry->type = line[0];
+
+	switch (entry->type) {
+		case 'P':
+			if (sscanf(line, "P %16llx%n", &tid, &len) < 1) return false;
+			break;
+
+		case 'M':
+			if (sscanf(line, "M %16llx %11s%n", &tid, entry->name, &len) < 2) return false;
+			break;
+
+		case 'C':
+			if (sscanf(line, "C %16llx %8x %40[0-9a-f]%n", &tid, &entry->value, hash, &len) < 3 || strlen(hash) != 40) return false;
+			for (int i = 0; i < 20; i++)
+				sscanf(hash + (i * 2), "%2hhx", &entry->hash[i]);
+			break;
+
+		case 'F':
+			if (sscanf(line, "F %16llx %u%n", &tid, &entry->value, &len) < 2) return false;
+			break;
+
+		default:
+			return false;
+	}
+
+	entry->titleID = tid;
+	return line[len] == '\n';
+}
+
+static void Write(const JournalEntry* entry) {
+	if (!journal || !Remember(entry))
+		return;
+
+	switch (entry->type) {
+		case 'P': fprintf(journal, "P %016llx\n", entry->titleID); break;
+		case 'M': fprintf(journal, "M %016llx %s\n", entry->titleID, entry->name); break;
+		case 'F': fprintf(journal, "F %016llx %u\n", entry->titleID, entry->value); break;
+		case 'C':
+			fprintf(journal, "C %016llx %08x ", entry->titleID, entry->value);
+			for (int i = 0; i < 20; i++)
+				fprintf(journal, "%02x", entry->hash[i]);
+			fputc('\n', journal);
+			break;
+	}
+
+	// Straight to the card, that's the whole point.
+	fflush(journal);
+	fsync(fileno(journal));
+}
+
+int JournalOpen(const char* path) {
+	char line[96];
+	int titles = 0, contents = 0, finished = 0;
+	JournalEntry entry;
+
+	num_entries = 0;
+	strncpy(journal_path, path, sizeof(journal_path) - 1);
+
+	FILE* fp = fopen(path, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (!ParseLine(line, &entry) || !Remember(&entry))
+				continue;
+
+			switch (entry.type) {
+				case 'P': titles++; break;
+				case 'C': contents++; break;
+				case 'F': finished++; break;
+			}
+		}
+
+		fclose(fp);
+	}
+
+	if (num_entries)
+		LogPrintf("Picking up where the last run stopped: %i/%i titles done, %i contents already on the SD card.\n\n",
+			   finished, titles, contents);
+
+	journal = fopen(path, "a");
+	if (!journal)
+		return -errno;
+
+	return num_entries;
+}
+
+void JournalClose(bool finished) {
+	if (!journal)
+		return;
+
+	fclose(journal);
+	journal = NULL;
+
+	// Nothing in it either way, if the batch never got as far as planning.
+	if (finished || !num_entries)
+		remove(journal_path);
+
+	num_entries = 0;
+}
+
+void JournalPlanned(int64_t titleID) {
+	Write(&(JournalEntry){ 'P', titleID });
+}
+
+void JournalMeta(int64_t titleID, const char* name) {
+	JournalEntry entry = { 'M', titleID };
+
+	strncpy(entry.name, name, sizeof(entry.name) - 1);
+	Write(&entry);
+}
+
+void JournalContent(int64_t titleID, uint32_t cid, const unsigned char hash[20]) {
+	JournalEntry entry = { 'C', titleID, cid };
+
+	memcpy(entry.hash, hash, sizeof(entry.hash));
+	Write(&entry);
+}
+
+void JournalFinished(int64_t titleID, uint16_t version) {
+	Write(&(JournalEntry){ 'F', titleID, version });
+}
+
+bool JournalHasMeta(int64_t titleID, const char* name) {
+	JournalEntry entry = { 'M', titleID };
+
+	strncpy(entry.name, name, sizeof(entry.name) - 1);
+	return journal && Find(&entry);
+}
+
+bool JournalHasContent(int64_t titleID, uint32_t cid, const unsigned char hash[20]) {
+	JournalEntry entry = { 'C', titleID, cid };
+
+	memcpy(entry.hash, hash, sizeof(entry.hash));
+	return journal && Find(&entry);
+}
+
+bool JournalIsFinished(int64_t titleID, uint16_t version) {
+	return journal && Find(&(JournalEntry){ 'F', titleID, version });
+}
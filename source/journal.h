@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JOURNAL_PATH "sd:/restorer-journal.txt"
+
+/*
+ * What the current batch has gotten done, on the SD card, one line per step, synced as it's written.
+ * If the batch never finishes (power cut, stalled download, HOME), the next run skips the titles that
+ * were already installed, and takes the staged metadata and contents it already checked as they are.
+ *
+ *   P <title ID>                      planned
+ *   M <title ID> <tmd|tmd.N|cetk>     metadata staged
+ *   C <title ID> <content ID> <SHA-1>  content staged and checked
+ *   F <title ID> <version>            ES_AddTitleFinish went through
+ */
+int  JournalOpen(const char* path);
+void JournalClose(bool finished); // finished: the batch is done, throw the journal away
+
+void JournalPlanned(int64_t titleID);
+void JournalMeta(int64_t titleID, const char* name);
+void JournalContent(int64_t titleID, uint32_t cid, const unsigned char hash[20]);
+void JournalFinished(int64_t titleID, uint16_t version);
+
+bool JournalHasMeta(int64_t titleID, const char* name);
+bool JournalHasContent(int64_t titleID, uint32_t cid, const unsigned char hash[20]);
+bool JournalIsFinished(int64_t titleID, uint16_t version);
@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "log.h"
+
+static LogHandler log_handler = NULL;
+static void* log_userp = NULL;
+
+void SetLogHandler(LogHandler handler, void* userp) {
+	log_handler = handler;
+	log_userp   = userp;
+}
+
+void LogPrintf(const char* fmt, ...) {
+	char text[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (!log_handler) {
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+	log_handler(text, log_userp);
+}
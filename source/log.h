@@ -0,0 +1,9 @@
+#include <stdarg.h>
+
+// Where the restore code's messages go. Straight to the console unless something else wants them (see engine.h).
+typedef void (*LogHandler)(const char* text, void* userp);
+
+void SetLogHandler(LogHandler handler, void* userp);
+
+[[gnu::format(printf, 1, 2)]]
+void LogPrintf(const char* fmt, ...);
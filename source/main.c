@@ -1,7 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/param.h>
 #include <gccore.h>
+#include <fat.h>
 #include <wiiuse/wpad.h>
 
 #include "iospatch.h"
@@ -9,9 +16,38 @@
 #include "pad.h"
 #include "network.h"
 #include "nus.h"
+#include "arena.h"
+#include "memprof.h"
+#include "verify.h"
+#include "bench.h"
+#include "config.h"
+#include "nand.h"
+#include "update.h"
+#include "serve.h"
+#include "journal.h"
+#include "tune.h"
+#include "signcache.h"
+#include "snapshot.h"
+#include "engine.h"
+#include "log.h"
+#include "trace.h"
 
 #define VERSION "1.2.0"
 
+// Everything the restore pipeline allocates comes out of this, for the whole batch.
+#ifndef SESSION_MEMORY_CEILING
+#define SESSION_MEMORY_CEILING	(4 << 20)
+#endif
+#define SESSION_IOBUF_SIZE		(512 << 10)
+#define SESSION_IOBUF_COUNT		2
+
+// For the time estimate, until something's actually been measured.
+#define PLAN_DOWNLOAD_KBPS		400
+#define PLAN_NAND_KBPS			1500
+
+// Create this folder on the SD card to have everything downloaded before anything is installed.
+#define STAGING_DIR				"sd:/restorer-cache"
+
 [[gnu::weak, gnu::format(printf, 1, 2)]]
 void OSReport(const char* fmt, ...) {}
 
@@ -21,6 +57,8 @@ typedef enum {
 
 static ConsoleType ThisConsole = Wii;
 static int ThisRegion = 0;
+static bool ForceInstall = false;
+static bool ForcePurge = false;
 
 const char GetSystemRegionLetter(void) {
 	switch (ThisRegion) {
@@ -83,13 +121,21 @@ int64_t getTitleID(Channel* ch) {
 	switch (ch->regiontype) {
 		case regiontype_free:		return ch->titleID;
 		case regiontype_specific:	return ch->titleID | GetSystemRegionLetter();
-		case regiontype_freeandkr:	return ch->titleID | (ThisRegion == CONF_REGION_KR) ? 'K' : 'A';
+		case regiontype_freeandkr:	return ch->titleID | ((ThisRegion == CONF_REGION_KR) ? 'K' : 'A');
 	}
 
 	return 0;
 }
 
-static bool SelectChannels(Channel* channels[], int cnt) {
+typedef enum {
+	action_cancel = 0,
+	action_install,
+	action_verify,
+	action_update,
+	action_serve,
+} MenuAction;
+
+static MenuAction SelectChannels(Channel* channels[], int cnt) {
 	int index = 0, curX = 0, curY = 0;
 
 	CON_GetPosition(&curX, &curY);
@@ -118,25 +164,149 @@ static bool SelectChannels(Channel* channels[], int cnt) {
 			}
 
 			else if (buttons & WPAD_BUTTON_A) { ch->selected ^= true; break; }
-			else if (buttons & WPAD_BUTTON_PLUS) return true;
-			else if (buttons & (WPAD_BUTTON_B | WPAD_BUTTON_HOME)) return false;
+			else if (buttons & WPAD_BUTTON_PLUS) return action_install;
+			else if (buttons & WPAD_BUTTON_MINUS) return action_verify;
+			else if (buttons & WPAD_BUTTON_1) return action_update;
+			else if (buttons & WPAD_BUTTON_2) return action_serve;
+			else if (buttons & (WPAD_BUTTON_B | WPAD_BUTTON_HOME)) return action_cancel;
+		}
+	}
+}
+
+// Returns how many channels are left selected, i.e. need restoring.
+static int VerifyChannels(Channel* channels[], int cnt) {
+	int ret, restore = 0;
+	bool any = false;
+
+	for (int i = 0; i < cnt; i++)
+		any |= channels[i]->selected;
+
+	if (any) {
+		for (int i = 0; i < cnt; i++) {
+			Channel* ch = channels[i];
+			VerifyResult result;
+
+			if (!ch->selected) continue;
+
+			printf("[*] Verifying %s... ", ch->name);
+			ret = VerifyTitle(getTitleID(ch), &result);
+			if (ret < 0)
+				printf("not installed (%i)\n", ret);
+			else if (VerifyFailed(&result))
+				printf("%hu corrupt, %hu missing of %hu contents!\n", result.corrupt, result.missing, result.num_contents);
+			else {
+				puts("OK");
+				ch->selected = false;
+				continue;
+			}
+
+			restore++;
+		}
+
+		return restore;
+	}
+
+	VerifyResult failed[32];
+	uint32_t maxfailed = sizeof(failed) / sizeof(VerifyResult), failcnt = maxfailed;
+
+	puts("[*] Verifying all installed titles...");
+	ret = VerifyAllTitles(failed, &failcnt);
+	if (ret < 0) {
+		printf("Failed! (%i)\n", ret);
+		return 0;
+	}
+
+	printf("Checked %i titles, %u failed.\n", ret, failcnt);
+	if (failcnt > maxfailed)
+		printf("(Only the first %u are listed here. Restore these, then verify again for the rest.)\n", maxfailed);
+
+	for (VerifyResult* result = failed; result < failed + MIN(failcnt, maxfailed); result++) {
+		const char* name = NULL;
+
+		for (int i = 0; i < cnt; i++) {
+			if (getTitleID(channels[i]) == result->titleID) {
+				name = channels[i]->name;
+				channels[i]->selected = true;
+				restore++;
+				break;
+			}
 		}
+
+		printf("	%016llx: %hu corrupt, %hu missing of %hu contents (%s)\n", result->titleID,
+			   result->corrupt, result->missing, result->num_contents, name ?: "can't restore this one");
 	}
+
+	return restore;
+}
+
+// Selects the channels that have an update. Returns how many that was.
+static int CheckForUpdates(Channel* channels[], int cnt) {
+	int ret, outdated = 0;
+	size_t mark = ArenaMark();
+	TitleUpdate* updates;
+	uint32_t count;
+
+	puts("[*] Checking for updates...");
+	ret = GetSystemUpdates(GetSystemRegionLetter(), &updates, &count);
+	if (ret < 0) {
+		printf("Failed! (%i, %s)\n", ret, GetLastDownloadError());
+		ArenaRelease(mark);
+		return 0;
+	}
+
+	for (TitleUpdate* update = updates; update < updates + count; update++) {
+		const char* name = NULL;
+
+		if (!TitleOutdated(update)) continue;
+
+		for (int i = 0; i < cnt; i++) {
+			if (getTitleID(channels[i]) == update->titleID) {
+				name = channels[i]->name;
+				channels[i]->selected = true;
+				outdated++;
+				break;
+			}
+		}
+
+		printf("	%016llx: v%hu, v%hu is out (%s)\n", update->titleID, update->installed, update->latest,
+			   name ?: "not one of ours, use the System Menu for this");
+	}
+
+	if (!outdated)
+		puts("Everything here is up to date.");
+
+	ArenaRelease(mark);
+	return outdated;
 }
 
 int InstallChannelGeneric(int64_t titleID, bool force_purge) {
+	int ret = 0;
 	struct Title local, remote;
 
-	int retl = GetInstalledTitle(titleID, &local);
+	int retl = GetInstalledTitleTier(titleID, TITLE_VIEW, &local);
+
+	force_purge |= ForcePurge;
+
+	// The last run got this far before it stopped. Forcing it means doing it again anyway.
+	if (retl == 0 && !force_purge && !ForceInstall && JournalIsFinished(titleID, TitleVersion(&local))) {
+		LogPrintf("	>> Already installed last time.\n");
+		FreeTitle(&local);
+		return 0;
+	}
+
 	int retr = DownloadTitleMeta(titleID, -1, &remote);
 
-	if (retr < 0)
+	if (retr < 0) {
+		FreeTitle(&local);
 		return retr;
+	}
 
-	if (force_purge || retl < 0 || local.tmd->title_version < remote.tmd->title_version)
-		return InstallTitle(&remote, force_purge);
+	if (force_purge || ForceInstall || retl < 0 || TitleVersion(&local) < remote.tmd->title_version)
+		ret = InstallTitle(&remote, force_purge);
 
-	return 0;
+	FreeTitle(&remote);
+	FreeTitle(&local);
+	return ret;
 }
 
 static int InstallChannel(Channel* ch) {
@@ -159,8 +329,8 @@ static int install_pc_1_1(void) {
 
 		int ret = GetInstalledTitle(0x0000000100000000 | 56, &vIOS56);
 		if (ret < 0) {
-			printf("GetInstalledTitle(IOS56) returned %i, why?\n", ret);
-			printf("Is it Decaffeinator time already?\n");
+			LogPrintf("GetInstalledTitle(IOS56) returned %i, why?\n", ret);
+			LogPrintf("Is it Decaffeinator time already?\n");
 			return ret;
 		}
 
@@ -177,8 +347,9 @@ static int install_pc_1_1(void) {
 
 	// Alright, let's make the dummy now.
 	struct Title HAAA;
-	int ret = GetInstalledTitle(0x0001000248414100 | regionLetter, &HAAA);
-	if (ret < 0 || HAAA.tmd->title_version > 2 /* photo_upgrader? */ ) {
+	int ret = GetInstalledTitleTier(0x0001000248414100 | regionLetter, TITLE_VIEW, &HAAA);
+	if (ret < 0 || TitleVersion(&HAAA) > 2 /* photo_upgrader? */ || LoadInstalledTitle(&HAAA, TITLE_FULL) < 0) {
+		FreeTitle(&HAAA);
 		ret = DownloadTitleMeta(0x0001000248414100 | regionLetter, -1, &HAAA);
 		if (ret < 0)
 			return ret;
@@ -263,7 +434,9 @@ static Channel channels[] = {
 		"to remove wuphax. (i.e. the Mii Channel is booting you to CTGP-R, or\n"
 		"'boot.elf not found!', or whatever.)",
 
+		.regiontype = regiontype_free,
 		.regionflag = regionflag_nokr,
+		.titleID    = 0x0001000248414341,
 		.install    = install_mii_channel,
 	},
 
@@ -286,13 +459,17 @@ static Channel channels[] = {
 		"Photo Channel 1.1 adds support for SDHC (and SDXC!) memory cards,\n"
 		"as well as setting the banner on the Wii Menu to a photo of your choice.",
 
-		.install = install_pc_1_1
+		.regiontype = regiontype_freeandkr,
+		.titleID    = 0x0001000248415900,
+		.install    = install_pc_1_1
 	},
 
 	{
 		.name = "Wii Shop Channel",
 
-		.install = install_shop_channel,
+		.regiontype = regiontype_freeandkr,
+		.titleID    = 0x0001000248414200,
+		.install    = install_shop_channel,
 	},
 
 	{
@@ -324,6 +501,390 @@ static Channel channels[] = {
 
 #define NBR_CHANNELS (sizeof(channels) / sizeof(Channel))
 
+#ifdef BENCH_SERVER
+/*
+ * Installs every channel against tools/nus-standin.py, once per scenario it offers, with ES emulated
+ * so nothing touches the NAND. e.g. make BENCHMARK=1 BENCH_SERVER=http://192.168.1.2:8000
+ */
+static void RunRestoreBenchmark(Channel* channels[], int cnt) {
+	char url[96];
+	blob scenarios = {};
+
+	sprintf(url, "%s/scenarios", BENCH_SERVER);
+	int ret = DownloadFile(url, DOWNLOAD_BLOB, &scenarios, NULL);
+	if (ret < 0) {
+		printf("Failed to get the scenario list from %s! (%i, %s)\n", BENCH_SERVER, ret, GetLastDownloadError());
+		return;
+	}
+
+	ES = &ESEmulated;
+	ForceInstall = true;
+
+	char* list = scenarios.ptr;
+	for (char* name = list; name < list + scenarios.size;) {
+		char* end = memchr(name, '\n', list + scenarios.size - name) ?: list + scenarios.size;
+		int namelen = end - name, failed = 0;
+
+		if (!namelen) {
+			name = end + 1;
+			continue;
+		}
+
+		sprintf(url, "%s/%.*s", BENCH_SERVER, namelen, name);
+		SetNUSServer(url);
+
+		// Scenarios replaying a recorded session come with the trace, for the ES side of it.
+		blob trace = {};
+		size_t trace_mark = ArenaMark();
+		strcat(url, "/trace");
+		if (DownloadFile(url, DOWNLOAD_BLOB, &trace, NULL) == 0 && (ret = ESEmulatedReplay(trace.ptr, trace.size)) > 0)
+			printf("Replaying %i recorded ES calls.\n", ret);
+
+		BenchDownloads(GetNUSServer());
+		ResetDownloadStats();
+
+		u64 start = gettime();
+		for (int i = 0; i < cnt; i++) {
+			size_t mark = ArenaMark();
+			printf("[*] %.*s: %s\n", namelen, name, channels[i]->name);
+			if (InstallChannel(channels[i]) < 0)
+				failed++;
+
+			ArenaRelease(mark);
+		}
+		u32 elapsed = diff_msec(start, gettime());
+
+		const DownloadStats* stats = GetDownloadStats();
+		printf("\n%-16.*s %8u ms %10llu bytes %4u files %3u retries %2i failed\n\n",
+			   namelen, name, elapsed, stats->bytes, stats->files, stats->retries, failed);
+
+		ESEmulatedReplay(NULL, 0);
+		ArenaRelease(trace_mark);
+		name = end + 1;
+	}
+
+	SetNUSServer(NULL);
+	ForceInstall = false;
+	ES = &ESNative;
+}
+#endif
+
+typedef struct {
+	Channel* channel;
+	int ret;
+	u32 time;
+	u32 download; // ms of that spent downloading
+	u32 retries;
+	u64 bytes;
+} ChannelResult;
+
+// Hands the staging cache out to the other consoles on the LAN, until HOME is pressed.
+static void ServeCache(const char* dir) {
+	struct stat st;
+
+	if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		printf("Nothing to serve, %s doesn't exist.\n", dir);
+		return;
+	}
+
+	int ret = ServeStart(dir, SERVE_PORT);
+	if (ret < 0) {
+		printf("Failed to start serving %s! (%i)\n", dir, ret);
+		return;
+	}
+
+	printf("Serving %s at http://%s:%u\n", dir, PrintIPAddress(), SERVE_PORT);
+	puts("Other consoles will find this one on their own, or put \"peer = <that address>\" in their restorer.ini.");
+	puts("Press HOME to stop.\n");
+
+	for (;;) {
+		scanpads();
+		if (buttons_down(WPAD_BUTTON_HOME))
+			break;
+
+		printf("\r\t>> %u requests so far", ServeRequests());
+		VIDEO_WaitVSync();
+	}
+
+	putchar('\n');
+	ServeStop();
+}
+
+// Returns false if the user changed their mind.
+static bool AskForChannels(Channel* channels[], int cnt) {
+	puts(
+		"Select the channels you would like to restore.\n"
+		"Press A to toggle an option. Press +/START to begin.\n"
+		"Press -/Z to check the selected channels (or everything) for corruption.\n"
+		"Press 1/X to check for updates.\n"
+		"Press 2/Y to share " STAGING_DIR " with the other consoles on the LAN.\n"
+		"Press B to cancel.\n" );
+
+
+	switch (SelectChannels(channels, cnt)) {
+		case action_cancel:
+			return false;
+
+		case action_verify:
+			puts("\n");
+			if (!VerifyChannels(channels, cnt)) {
+				puts("\nNothing to restore.");
+				return false;
+			}
+
+			puts("\nPress +/START to restore the channels above, or B to cancel.");
+			wait_button(WPAD_BUTTON_PLUS | WPAD_BUTTON_B);
+			return !buttons_down(WPAD_BUTTON_B);
+
+		case action_update:
+			puts("\n");
+			if (!CheckForUpdates(channels, cnt))
+				return false;
+
+			puts("\nPress +/START to update the channels above, or B to cancel.");
+			wait_button(WPAD_BUTTON_PLUS | WPAD_BUTTON_B);
+			return !buttons_down(WPAD_BUTTON_B);
+
+		case action_serve:
+			puts("\n");
+			ServeCache(STAGING_DIR);
+			return false;
+
+		case action_install:
+			break;
+	}
+
+	return true;
+}
+
+// Selects what the config asked for. Returns false if that turned out to be nothing.
+static bool SelectFromConfig(Channel* channels[], int cnt, const char* list) {
+	char buffer[256];
+	bool any = false;
+
+	strcpy(buffer, list);
+	for (char* item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+		while (isspace((unsigned char)*item)) item++;
+		for (char* end = item + strlen(item); end > item && isspace((unsigned char)end[-1]); end--)
+			end[-1] = 0;
+
+		char* end;
+		int64_t titleID = strtoll(item, &end, 16);
+		bool isTitleID = (end - item == 16 && !*end);
+		bool all = !strcasecmp(item, "all"), found = false;
+
+		if (!strcasecmp(item, "outdated")) {
+			any |= CheckForUpdates(channels, cnt) > 0;
+			continue;
+		}
+
+		for (int i = 0; i < cnt; i++) {
+			if (all || !strcasecmp(channels[i]->name, item) || (isTitleID && getTitleID(channels[i]) == titleID)) {
+				channels[i]->selected = true;
+				found = true;
+			}
+		}
+
+		if (!found)
+			printf("\t>> '%s' isn't something this console can restore.\n", item);
+
+		any |= found;
+	}
+
+	if (!any)
+		puts("Nothing to restore.");
+
+	return any;
+}
+
+// Same as InstallChannel, but moves down the list of mirrors until one works.
+static int InstallChannelFromMirrors(Channel* ch, const Config* config) {
+	int ret = InstallChannel(ch);
+
+	for (int i = 1; ret < 0 && i < config->num_servers; i++) {
+		LogPrintf("\t>> Failed (%i), trying %s...\n", ret, config->servers[i]);
+		SetNUSServer(config->servers[i]);
+		ret = InstallChannel(ch);
+	}
+
+	SetNUSServer(config->num_servers ? config->servers[0] : NULL);
+	return ret;
+}
+
+typedef struct {
+	Channel* channel;
+	const Config* config;
+} ChannelJob;
+
+static int ChannelJobRun(void* arg) {
+	ChannelJob* cj = arg;
+	return cj->config ? InstallChannelFromMirrors(cj->channel, cj->config) : InstallChannel(cj->channel);
+}
+
+static void ShowEngineEvent(const EngineEvent* event, void* userp) {
+	switch (event->type) {
+		case ENGINE_LOG:
+			fputs(event->text, stdout);
+			break;
+
+		case ENGINE_PROGRESS:
+			printf("\r\t\t%.2f/%.2f KB // %.2f KB/s...", event->now / 1024.f, event->total / 1024.f,
+				   (event->now / 1024.f) / ((event->elapsed ?: 1) / 1000.f));
+			break;
+
+		default:
+			break;
+	}
+}
+
+// On the engine thread, so the screen keeps up and HOME can stop it. Straight through if there isn't one.
+static int RunChannel(Channel* ch, const Config* config, ChannelResult* result) {
+	ChannelJob cj = { ch, config };
+	Job job = { .type = JOB_CALL, .call = ChannelJobRun, .arg = &cj };
+	DownloadStats before = *GetDownloadStats();
+	u64 start = gettime();
+	bool cancelled = false;
+
+	MemProfBeginTitle(ch->name);
+	if (EngineSubmit(&job) < 0) {
+		EngineRun(&job);
+	}
+	else {
+		while (EnginePump()) {
+			scanpads();
+			if (!cancelled && buttons_down(WPAD_BUTTON_HOME)) {
+				puts("\n\t>> Stopping...");
+				EngineCancel(&job);
+				cancelled = true;
+			}
+
+			VIDEO_WaitVSync();
+		}
+	}
+	int ret = job.result;
+	TraceFlush();
+
+	result->channel = ch;
+	result->ret     = ret;
+	result->time     += diff_msec(start, gettime());
+	result->download += ticks_to_millisecs(GetDownloadStats()->time - before.time);
+	result->retries  += GetDownloadStats()->retries - before.retries;
+	result->bytes    += GetDownloadStats()->bytes - before.bytes;
+
+	if (job.state == JOB_CANCELLED) {
+		puts("Stopped.");
+		return -ECANCELED;
+	}
+
+	if (ret < 0)
+		printf("Failed! (%i)\n", ret);
+	else
+		puts("OK!");
+
+	return ret;
+}
+
+/*
+ * Goes through the selected channels without installing anything, to see what it will take.
+ * Returns false if it won't fit, or the user changed their mind.
+ */
+static bool PlanChannels(const Config* config) {
+	int ret;
+	InstallPlan plan = {};
+	NANDStats nand;
+
+	puts("[*] Planning...");
+	PlanInstalls(&plan);
+	for (Channel* ch = channels; ch < channels + NBR_CHANNELS; ch++) {
+		if (!ch->selected) continue;
+
+		size_t mark = ArenaMark();
+		ret = config ? InstallChannelFromMirrors(ch, config) : InstallChannel(ch);
+		ArenaRelease(mark);
+		if (ret < 0)
+			printf("\t>> Couldn't plan %s (%i), it won't be counted.\n", ch->name, ret);
+	}
+	PlanInstalls(NULL);
+
+	if (!plan.titles) {
+		puts("\nEverything is already up to date.");
+		return false;
+	}
+
+	ret = NANDGetStats(&nand);
+	if (ret < 0) {
+		printf("Failed to get NAND usage! (%i)\n", ret);
+		return false;
+	}
+
+	// Small files are all latency, only trust the measurement if there was enough of it.
+	const DownloadStats* stats = GetDownloadStats();
+	u32 dl_ms = ticks_to_millisecs(stats->time);
+	u32 dl_kbps = (stats->bytes >= (256 << 10) && dl_ms) ? (stats->bytes / dl_ms) * 1000 / 1024 : PLAN_DOWNLOAD_KBPS;
+	u32 estimate = ((plan.download >> 10) / (dl_kbps ?: 1)) + ((plan.nand >> 10) / PLAN_NAND_KBPS);
+
+	printf("\n%u titles, %u contents to install.\n", plan.titles, plan.contents);
+	printf("\tDownload: %8llu KB (at ~%u KB/s)\n", plan.download >> 10, dl_kbps);
+	printf("\tNAND:     %8llu KB, %u of %u free clusters, %u of %u free inodes\n", plan.nand >> 10,
+		   plan.clusters, nand.free_clusters, plan.inodes, nand.free_inodes);
+	printf("\tThis should take about %u:%02u.\n\n", estimate / 60, estimate % 60);
+
+	if (plan.clusters > nand.free_clusters || plan.inodes > nand.free_inodes) {
+		puts("There isn't enough space on the NAND for all of this!\n"
+			 "Free some up (Data Management), or select fewer channels.");
+		return false;
+	}
+
+	if (config)
+		return true;
+
+	puts("Press +/START to begin, or B to cancel.");
+	wait_button(WPAD_BUTTON_PLUS | WPAD_BUTTON_B);
+	return !buttons_down(WPAD_BUTTON_B);
+}
+
+static int WriteReport(const Config* config, ChannelResult results[], int cnt, bool finished) {
+	char path[96];
+	uint32_t deviceID = 0;
+	u64 bytes = 0;
+	u32 time = 0;
+	int failed = 0;
+
+	ES_GetDeviceID(&deviceID);
+	sprintf(path, "%s%s%08X.txt", config->reports, config->reports[strlen(config->reports) - 1] == '/' ? "" : "/", deviceID);
+
+	FILE* fp = fopen(path, "w");
+	if (!fp) {
+		printf("Failed to write the report to %s! (%i)\n", path, errno);
+		return -errno;
+	}
+
+	fprintf(fp, "System Channel Restorer " VERSION "\n");
+	fprintf(fp, "Console: %08X, %s, %s\n", deviceID, strConsoleType(ThisConsole), strRegionLetter(GetSystemRegionLetter()));
+	fprintf(fp, "Server:  %s\n", GetNUSServer());
+	fprintf(fp, "Memory:  %zu/%zu KB\n\n", ArenaPeak() >> 10, ArenaCeiling() >> 10);
+
+	// tools/fleet-report.py reads these, keep the columns in order.
+	for (ChannelResult* result = results; result < results + cnt; result++) {
+		fprintf(fp, "%-24s %-12s %8u ms %8llu KB %8u ms download %3u retries\n", result->channel->name,
+				result->ret < 0 ? "FAILED" : "OK", result->time, result->bytes >> 10, result->download, result->retries);
+		if (result->ret < 0) {
+			fprintf(fp, "%24s (%i)\n", "", result->ret);
+			failed++;
+		}
+
+		time  += result->time;
+		bytes += result->bytes;
+	}
+
+	fprintf(fp, "\n%i restored, %i failed, %u ms, %llu KB downloaded%s\n", cnt - failed, failed, time, bytes >> 10,
+			finished ? "" : " (stopped early)");
+
+	fclose(fp);
+	printf("\t>> Report saved to %s\n", path);
+	return 0;
+}
+
 int main() {
 	puts(
 		"Wii System Channel Restorer by thepikachugamer\n"
@@ -337,6 +898,68 @@ int main() {
 	ISFS_Initialize();
 	CONF_Init();
 
+	Config config;
+	ChannelResult results[NBR_CHANNELS] = {};
+	int nresults = 0;
+	bool sd = fatInitDefault(), headless = false, finished = false;
+	const char* cache = NULL;
+	struct stat st;
+
+	if (sd && LoadConfig(CONFIG_PATH, &config) == 0) {
+		printf("Found %s, not asking any questions.\n\n", CONFIG_PATH);
+		headless       = true;
+		ForceInstall   = config.force;
+		ForcePurge     = config.purge;
+		if (config.num_servers)
+			SetNUSServer(config.servers[0]);
+		if (config.cache[0])
+			cache = config.cache;
+		if (config.connections)
+			NUSDownloadSegments = config.connections;
+		if (config.update[0])
+			SetUpdateURL(config.update);
+		if (config.peer[0] && strcasecmp(config.peer, "auto"))
+			SetNUSPeer(config.peer);
+	}
+	else if (sd && !stat(STAGING_DIR, &st) && S_ISDIR(st.st_mode)) {
+		cache = STAGING_DIR;
+	}
+
+	int ret = ArenaInit(SESSION_MEMORY_CEILING, SESSION_IOBUF_SIZE, SESSION_IOBUF_COUNT);
+	if (ret < 0) {
+		printf("Failed to reserve %u KB of memory! (%i)\n", SESSION_MEMORY_CEILING >> 10, ret);
+		goto exit;
+	}
+
+	CryptoInit();
+	TraceStartRecording("sd:/restorer-session.trc");
+	if (sd)
+		JournalOpen(JOURNAL_PATH);
+
+	// Once per console (it's kept on the SD card), then real installs keep it up to date.
+	if (sd && TuneLoad(TUNE_PATH) < 0) {
+		puts("Measuring how this console's NAND likes to be read...");
+		ret = TuneCalibrate();
+		if (ret < 0)
+			printf("(failed, %i. Using %u KB for everything.)\n", ret, ArenaBufferSize() >> 10);
+	}
+	printf("NAND reads in %u KB chunks, ES writes in %u KB chunks.\n\n", TuneChunk(TUNE_NAND_READ) >> 10, TuneChunk(TUNE_ES_WRITE) >> 10);
+
+#ifdef BENCHMARK
+	RunBenchmarks();
+#ifndef BENCH_SERVER
+	goto exit;
+#endif
+#endif
+
+	// After the benchmarks, they'd only fill it up with junk.
+	if (sd)
+		SignCacheOpen(SIGNCACHE_PATH);
+
+	// So a purge that goes wrong can be undone.
+	if (sd)
+		SetSnapshotDir(SNAPSHOT_DIR);
+
 	ThisRegion = CONF_GetRegion();
 	const char regionLetter = GetSystemRegionLetter();
 	if (!regionLetter) {
@@ -351,8 +974,8 @@ int main() {
 	}
 	else {
 		struct Title sm = {};
-		if (!GetInstalledTitle(0x100000002LL, &sm)) {
-			uint16_t sm_rev = sm.tmd->title_version;
+		if (!GetInstalledTitleTier(0x100000002LL, TITLE_VIEW, &sm)) {
+			uint16_t sm_rev = TitleVersion(&sm);
 			FreeTitle(&sm);
 			if ((sm_rev & 0xFFE0) == 0x1200)
 				ThisConsole = Mini;
@@ -361,12 +984,26 @@ int main() {
 
 	printf("Console region: %-24s    Console Type: %s\n\n", strRegionLetter(regionLetter), strConsoleType(ThisConsole));
 
-	int ret = network_init();
+	ret = network_init();
 	if (ret < 0) {
 		printf("Failed to initialize network! (%i)\n", ret);
 		goto exit;
 	}
 
+	ret = EngineStart(ShowEngineEvent, NULL);
+	if (ret < 0)
+		printf("Failed to start the restore thread (%i), HOME won't stop a download.\n", ret);
+
+	// Someone on the LAN might already have everything.
+	if (!GetNUSPeer() && (!headless || !strcasecmp(config.peer, "auto"))) {
+		char peer[96];
+
+		if (DiscoverPeer(peer, sizeof(peer), 500) == 0) {
+			printf("Found a console sharing its cache at %s, downloading from there first.\n\n", peer);
+			SetNUSPeer(peer);
+		}
+	}
+
 	int i = 0;
 	Channel* allowedChannels[NBR_CHANNELS] = {};
 	for (Channel* ch = channels; ch < channels + NBR_CHANNELS; ch++) {
@@ -380,33 +1017,83 @@ int main() {
 		allowedChannels[i++] = ch;
 	}
 
-	puts(
-		"Select the channels you would like to restore.\n"
-		"Press A to toggle an option. Press +/START to begin.\n"
-		"Press B to cancel.\n" );
+#ifdef BENCH_SERVER
+	RunRestoreBenchmark(allowedChannels, i);
+	goto exit;
+#endif
 
-
-	if (!SelectChannels(allowedChannels, i)) goto exit;
+	if (headless ? !SelectFromConfig(allowedChannels, i, config.channels) : !AskForChannels(allowedChannels, i))
+		goto exit;
 
 	putchar('\n');
 
+	if (cache)
+		SetStaging(STAGING_INSTALL, cache);
+
+	if (!PlanChannels(headless ? &config : NULL))
+		goto exit;
+
+	// Get everything onto the SD card first, so a bad connection can't leave ES hanging halfway through a title.
+	if (cache) {
+		printf("Downloading everything to %s first.\n", cache);
+		SetStaging(STAGING_DOWNLOAD, cache);
+		for (Channel* ch = channels; ch < channels + NBR_CHANNELS; ch++) {
+			if (!ch->selected) continue;
+
+			printf("[*] Downloading %s...\n", ch->name);
+			if (RunChannel(ch, headless ? &config : NULL, results + nresults++) == -ECANCELED)
+				goto exit;
+		}
+
+		SetStaging(STAGING_INSTALL, cache);
+		nresults = 0;
+		putchar('\n');
+	}
+
 	// what a mess of code this thing is
 	for (Channel* ch = channels; ch < channels + NBR_CHANNELS; ch++) {
 		if (!ch->selected) continue;
 
 		printf("[*] Installing %s...\n", ch->name);
-		ret = InstallChannel(ch);
-		if (ret < 0)
-			printf("Failed! (%i)\n", ret);
-		else
-			puts("OK!");
+		if (RunChannel(ch, headless ? &config : NULL, results + nresults++) == -ECANCELED)
+			goto exit;
+	}
+
+	SetStaging(STAGING_OFF, NULL);
+	finished = true;
+
+	printf("\nPeak memory usage: %zu/%zu KB\n", ArenaPeak() >> 10, ArenaCeiling() >> 10);
+	MemProfPrintAll();
+
+	if (headless && config.serve && cache) {
+		putchar('\n');
+		ServeCache(cache);
 	}
 
 exit:
+	if (headless)
+		WriteReport(&config, results, nresults, finished);
+
+	EngineStop();
+	JournalClose(finished);
+	if (sd)
+		TuneSave(TUNE_PATH);
+	TraceStopRecording();
+	TracePrint();
+	TraceDump("sd:/restorer-ipctrace.txt");
 	network_deinit();
 	ISFS_Deinitialize();
-	puts("\n\nPress HOME to exit.");
-	wait_button(WPAD_BUTTON_HOME);
+	CryptoDeinit();
+	ArenaDeinit();
+	if (sd)
+		fatUnmount("sd");
+
+	// Headless: straight back to the loader.
+	if (!headless) {
+		puts("\n\nPress HOME to exit.");
+		wait_button(WPAD_BUTTON_HOME);
+	}
+
 	WPAD_Shutdown();
 	return 0;
 }
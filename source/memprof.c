@@ -0,0 +1,113 @@
+#ifdef MEMPROFILE
+#include <stdio.h>
+#include <string.h>
+
+#include "memprof.h"
+#include "log.h"
+
+#define MEMPROF_MAX_TITLES 16
+
+typedef struct {
+	size_t allocs;
+	size_t frees;
+	size_t bytes;
+	size_t largest;
+	size_t peak;
+} PhaseStats;
+
+typedef struct {
+	const char* name;
+	size_t current;
+	size_t peak;
+	PhaseStats phase[MEMPHASE_COUNT];
+} TitleProfile;
+
+static const char* PhaseNames[MEMPHASE_COUNT] = {
+	[MEMPHASE_METADATA]  = "metadata",
+	[MEMPHASE_DOWNLOAD]  = "download",
+	[MEMPHASE_REENCRYPT] = "re-encrypt",
+	[MEMPHASE_ES]        = "ES",
+};
+
+static TitleProfile profiles[MEMPROF_MAX_TITLES] = { { "startup" } };
+static TitleProfile* current = profiles;
+static MemPhase phase = MEMPHASE_METADATA;
+
+// Live bytes carry over from one title to the next, so the counter is global.
+static size_t live = 0;
+
+void MemProfBeginTitle(const char* name) {
+	if (current < profiles + MEMPROF_MAX_TITLES - 1)
+		current++;
+
+	memset(current, 0, sizeof(TitleProfile));
+	current->name    = name;
+	current->current = current->peak = live;
+	phase = MEMPHASE_METADATA;
+}
+
+void MemProfSetPhase(MemPhase newphase) {
+	phase = newphase;
+}
+
+void MemProfAlloc(size_t size) {
+	PhaseStats* stats = current->phase + phase;
+
+	live += size;
+	stats->allocs++;
+	stats->bytes += size;
+	if (size > stats->largest)
+		stats->largest = size;
+	if (live > stats->peak)
+		stats->peak = live;
+
+	current->current = live;
+	if (live > current->peak)
+		current->peak = live;
+}
+
+void MemProfFree(size_t size) {
+	live -= (size > live) ? live : size;
+	current->phase[phase].frees++;
+	current->current = live;
+}
+
+// A block grown (or shrunk) in place. Counts as the size it is now, not as another allocation.
+void MemProfResize(size_t oldsize, size_t newsize) {
+	PhaseStats* stats = current->phase + phase;
+
+	live = live - ((oldsize > live) ? live : oldsize) + newsize;
+	if (newsize > oldsize)
+		stats->bytes += newsize - oldsize;
+	if (newsize > stats->largest)
+		stats->largest = newsize;
+	if (live > stats->peak)
+		stats->peak = live;
+
+	current->current = live;
+	if (live > current->peak)
+		current->peak = live;
+}
+
+static void PrintProfile(TitleProfile* prof) {
+	LogPrintf("[memprof] %s: current %zu bytes, peak %zu bytes\n", prof->name ?: "?", prof->current, prof->peak);
+	for (int i = 0; i < MEMPHASE_COUNT; i++) {
+		PhaseStats* stats = prof->phase + i;
+		if (!stats->allocs && !stats->frees)
+			continue;
+
+		LogPrintf("\t%-10s %4zu allocs, %4zu frees, %8zu bytes, largest %8zu, peak %8zu\n",
+				  PhaseNames[i], stats->allocs, stats->frees, stats->bytes, stats->largest, stats->peak);
+	}
+}
+
+void MemProfPrintCurrent(void) {
+	LogPrintf("[memprof] phase: %s\n", PhaseNames[phase]);
+	PrintProfile(current);
+}
+
+void MemProfPrintAll(void) {
+	for (TitleProfile* prof = profiles; prof <= current; prof++)
+		PrintProfile(prof);
+}
+#endif
@@ -0,0 +1,29 @@
+#include <stddef.h>
+
+typedef enum {
+	MEMPHASE_METADATA,
+	MEMPHASE_DOWNLOAD,
+	MEMPHASE_REENCRYPT,
+	MEMPHASE_ES,
+
+	MEMPHASE_COUNT
+} MemPhase;
+
+// Build with `make MEMPROFILE=1` to get allocation statistics. Otherwise these are no-ops.
+#ifdef MEMPROFILE
+void MemProfBeginTitle(const char* name);
+void MemProfSetPhase(MemPhase phase);
+void MemProfAlloc(size_t size);
+void MemProfFree(size_t size);
+void MemProfResize(size_t oldsize, size_t newsize);
+void MemProfPrintCurrent(void);
+void MemProfPrintAll(void);
+#else
+#define MemProfBeginTitle(name)	((void)0)
+#define MemProfSetPhase(phase)	((void)0)
+#define MemProfAlloc(size)		((void)0)
+#define MemProfFree(size)		((void)0)
+#define MemProfResize(oldsize, newsize)	((void)0)
+#define MemProfPrintCurrent()	((void)0)
+#define MemProfPrintAll()		((void)0)
+#endif
@@ -1,12 +1,18 @@
 #include <errno.h>
+#include <sys/param.h>
 #include <ogc/isfs.h>
+#include <ogc/semaphore.h>
+#include <ogc/lwp_watchdog.h>
 
 #include "nand.h"
-#include "malloc.h"
+#include "arena.h"
+#include "tune.h"
+#include "trace.h"
 
 int NANDReadFileSimple(const char* path, uint32_t size, unsigned char** outbuf, uint32_t* outsize) {
     int ret, fd;
     unsigned char* buffer = NULL;
+    size_t mark = ArenaMark();
     __aligned(0x20) fstats file_stats[1];
 
     if (!path || !outbuf || (!outsize && !size)) return -EINVAL;
@@ -24,7 +30,7 @@ int NANDReadFileSimple(const char* path, uint32_t size, unsigned char** outbuf,
         size = file_stats->file_length;
     }
 
-    buffer = memalign32(size);
+    buffer = ArenaAlloc(size);
     if (!buffer) {
         ret = -ENOMEM;
         goto error;
@@ -44,7 +50,148 @@ int NANDReadFileSimple(const char* path, uint32_t size, unsigned char** outbuf,
     return 0;
 
 error:
-    free(buffer);
+    ArenaRelease(mark);
     ISFS_Close(fd);
     return ret;
 }
+
+int NANDGetStats(NANDStats* stats) {
+    __aligned(0x20) NANDStats buffer[1];
+
+    int ret = ISFS_GetStats(buffer);
+    if (ret < 0)
+        return ret;
+
+    *stats = *buffer;
+    return 0;
+}
+
+typedef struct {
+    sem_t done;
+    int result;
+    int fd;
+    uint32_t length;
+    uint64_t start;
+} NANDAsyncRead;
+
+static s32 NANDReadCallback(s32 result, void* usrdata) {
+    NANDAsyncRead* read = usrdata;
+
+    // The time from submitting the read to IOS finishing it.
+    TraceRecord("ISFS_ReadAsync", read->fd, NULL, read->length, read->start, result);
+    if (result == (s32)read->length)
+        TuneRecord(TUNE_NAND_READ, read->length, gettime() - read->start);
+
+    read->result = result;
+    LWP_SemPost(read->done);
+    return 0;
+}
+
+static void NANDStartRead(NANDAsyncRead* read, int fd, uint32_t length) {
+    read->fd     = fd;
+    read->length = length;
+    read->start  = gettime();
+}
+
+int NANDStreamOpen(NANDStream* stream, const char* path) {
+    int ret;
+
+    stream->fd = ret = ISFS_Open(path, ISFS_OPEN_READ);
+    if (ret < 0)
+        return ret;
+
+    ret = ISFS_GetFileStats(stream->fd, &stream->stats);
+    if (ret < 0) {
+        NANDStreamClose(stream);
+        return ret;
+    }
+
+    stream->size = stream->stats.file_length;
+    return 0;
+}
+
+/*
+ * Reads the file in chunks of up to `chunksize` bytes (0 for whatever's fastest here, see tune.h), using both
+ * of the arena's I/O buffers: while the callback works on one chunk, IOS is already reading the next one into the other.
+ */
+int NANDStreamRun(NANDStream* stream, uint32_t chunksize, NANDChunkCallback cb, void* userp) {
+    int ret = 0;
+    unsigned char* buffers[2] = { ArenaGetBuffer(), ArenaGetBuffer() };
+    NANDAsyncRead read = {};
+    uint32_t offset = 0, length = 0;
+
+    if (!chunksize)
+        chunksize = TuneChunk(TUNE_NAND_READ);
+    if (chunksize > ArenaBufferSize())
+        chunksize = ArenaBufferSize();
+
+    if (!buffers[0] || !buffers[1]) {
+        ret = -ENOMEM;
+        goto finish;
+    }
+
+    LWP_SemInit(&read.done, 0, 1);
+
+    if (stream->size) {
+        length = MIN(stream->size, chunksize);
+        NANDStartRead(&read, stream->fd, length);
+        ret = ISFS_ReadAsync(stream->fd, buffers[0], length, NANDReadCallback, &read);
+        if (ret < 0)
+            goto cleanup;
+    }
+
+    for (int i = 0; offset < stream->size; i ^= 1) {
+        LWP_SemWait(read.done);
+        if (read.result != (int)length) {
+            ret = (read.result < 0) ? read.result : -EIO;
+            break;
+        }
+
+        uint32_t chunk = length, next = offset + chunk;
+        if (next < stream->size) {
+            length = MIN(stream->size - next, chunksize);
+            NANDStartRead(&read, stream->fd, length);
+            ret = ISFS_ReadAsync(stream->fd, buffers[i ^ 1], length, NANDReadCallback, &read);
+            if (ret < 0)
+                break;
+        }
+
+        ret = cb(buffers[i], chunk, offset, userp);
+        if (ret < 0) {
+            // Don't pull the buffer out from under IOS.
+            if (next < stream->size)
+                LWP_SemWait(read.done);
+
+            break;
+        }
+
+        offset = next;
+    }
+
+cleanup:
+    LWP_SemDestroy(read.done);
+
+finish:
+    ArenaPutBuffer(buffers[1]);
+    ArenaPutBuffer(buffers[0]);
+    return (ret < 0) ? ret : 0;
+}
+
+void NANDStreamClose(NANDStream* stream) {
+    if (stream->fd >= 0)
+        ISFS_Close(stream->fd);
+
+    stream->fd = -1;
+}
+
+int NANDStreamFile(const char* path, uint32_t chunksize, NANDChunkCallback cb, void* userp) {
+    NANDStream stream;
+
+    int ret = NANDStreamOpen(&stream, path);
+    if (ret < 0)
+        return ret;
+
+    ret = NANDStreamRun(&stream, chunksize, cb, userp);
+    NANDStreamClose(&stream);
+    return ret;
+}
@@ -1,4 +1,31 @@
 #include <stdint.h>
 #include <ogc/isfs.h>
 
+typedef int (*NANDChunkCallback)(unsigned char* chunk, uint32_t length, uint32_t offset, void* userp);
+
+typedef struct NANDStream {
+    int fd;
+    uint32_t size;
+    fstats stats __attribute__((aligned(0x20)));
+} NANDStream;
+
+// What /dev/fs says about the whole NAND. Clusters are 16 KB.
+typedef struct NANDStats {
+    uint32_t cluster_size;
+    uint32_t free_clusters;
+    uint32_t used_clusters;
+    uint32_t bad_clusters;
+    uint32_t reserved_clusters;
+    uint32_t free_inodes;
+    uint32_t used_inodes;
+} NANDStats;
+
+#define NAND_CLUSTER_SIZE 0x4000
+
+int NANDGetStats(NANDStats* stats);
 int NANDReadFileSimple(const char* path, uint32_t size, unsigned char** outbuf, uint32_t* outsize);
+
+int  NANDStreamOpen(NANDStream* stream, const char* path);
+int  NANDStreamRun(NANDStream* stream, uint32_t chunksize, NANDChunkCallback cb, void* userp);
+void NANDStreamClose(NANDStream* stream);
+int  NANDStreamFile(const char* path, uint32_t chunksize, NANDChunkCallback cb, void* userp);
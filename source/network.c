@@ -4,12 +4,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/param.h>
 #include <ogc/lwp_watchdog.h>
 #include <curl/curl.h>
 #include <arpa/inet.h>
 
+#include "arena.h"
+#include "log.h"
+#include "trace.h"
+
+#ifdef RECORD
+#include <mbedtls/sha1.h>
+#endif
+
+#define DOWNLOAD_MAX_RETRIES 3
+#define DOWNLOAD_MAX_SEGMENTS 8
+
 static int network_up = false;
 static char ebuffer[CURL_ERROR_SIZE] = {};
+static DownloadStats downloadstats = {};
+static ProgressCallback progress_cb = NULL;
+static void* progress_userp = NULL;
+
+volatile bool DownloadCancel = false;
 
 typedef size_t (*fwrite_wannabe)(void*, size_t, size_t, void*);
 typedef struct xferinfo_data_s {
@@ -19,6 +36,40 @@ typedef struct xferinfo_data_s {
 	curl_off_t lastvalue;
 } xferinfo_data;
 
+// Keeps count of what made it to the real write function, so a retry can pick up where it left off.
+typedef struct {
+	fwrite_wannabe write;
+	void* userp;
+	curl_off_t written;
+#ifdef RECORD
+	mbedtls_sha1_context sha; // of the whole body, for the session trace
+#endif
+} CountingWriter;
+
+// One byte range of a segmented download, on its own connection.
+typedef struct {
+	CURL* curl;
+	unsigned char* ptr; // where the next byte goes
+	uint64_t offset;    // and where that is in the file
+	size_t left;
+	int retries;
+
+	// This attempt at it
+	uint64_t from;
+	u64 started;
+	bool busy, checked, unranged;
+} Segment;
+
+// DownloadFileSegmented's way out when the server won't do ranges: the same windows, from one stream.
+typedef struct {
+	unsigned char* buffer;
+	size_t buffer_size, filled;
+	uint64_t left;
+	SegmentCallback cb;
+	void* userp;
+	int ret;
+} WindowWriter;
+
 char* PrintIPAddress() {
 	uint32_t ipaddr = gethostid();
 	static char ipstr[16] = {};
@@ -28,15 +79,14 @@ char* PrintIPAddress() {
 	return ipstr;
 }
 
-static size_t WriteToBlob(void* buffer, size_t size, size_t nmemb, void* userp) {
+size_t WriteToBlob(void* buffer, size_t size, size_t nmemb, void* userp) {
 	size_t length = size * nmemb;
 	blob* blob = userp;
 
-	// If ptr is NULL, then the call is equivalent to malloc(size), for all values of size.
-	unsigned char* _buffer = realloc(blob->ptr, blob->size + length);
+	// If ptr is NULL, then the call is equivalent to ArenaAlloc(size), for all values of size.
+	unsigned char* _buffer = ArenaRealloc(blob->ptr, blob->size, blob->size + length);
 	if (!_buffer) {
-		printf("WriteToBlob: out of memory (%zu + %zu bytes)\n", blob->size, length);
-		free(blob->ptr);
+		LogPrintf("WriteToBlob: out of memory (%zu + %zu bytes)\n", blob->size, length);
 		blob->ptr = NULL;
 		blob->size = 0;
 		return 0;
@@ -49,9 +99,46 @@ static size_t WriteToBlob(void* buffer, size_t size, size_t nmemb, void* userp)
 	return length;
 }
 
+static size_t WriteCounted(void* buffer, size_t size, size_t nmemb, void* userp) {
+	CountingWriter* writer = userp;
+
+	size_t ret = writer->write(buffer, size, nmemb, writer->userp);
+	writer->written += ret;
+	downloadstats.bytes += ret;
+#ifdef RECORD
+	mbedtls_sha1_update_ret(&writer->sha, buffer, ret);
+#endif
+	return ret;
+}
+
+static bool ShouldRetry(CURL* curl, CURLcode res) {
+	long status = 0;
+
+	if (DownloadCancel)
+		return false;
+
+	switch (res) {
+		case CURLE_HTTP_RETURNED_ERROR:
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+			return status >= 500;
+
+		// Our own write function said no, or the server can't resume. Trying again won't help.
+		case CURLE_WRITE_ERROR:
+		case CURLE_OUT_OF_MEMORY:
+		case CURLE_RANGE_ERROR:
+			return false;
+
+		default:
+			return true;
+	}
+}
+
 static int xferinfo_cb(void* userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
 	xferinfo_data* data = (xferinfo_data*)userp;
 
+	if (DownloadCancel)
+		return -1;
+
 	if (!dltotal)
 		return 0;
 
@@ -67,14 +154,19 @@ static int xferinfo_cb(void* userp, curl_off_t dltotal, curl_off_t dlnow, curl_o
 		data->lastvalue_time = elapsed;
 	}
 	else if (elapsed - data->lastvalue_time >= 15000) {
-		printf("\n\t\tThis download hasn't moved for a while (%ums). Let's stop.\n", elapsed - data->lastvalue_time);
+		LogPrintf("\n\t\tThis download hasn't moved for a while (%ums). Let's stop.\n", elapsed - data->lastvalue_time);
 		return -1;
 	}
 
+	if (progress_cb) {
+		progress_cb(dlnow, dltotal, elapsed, progress_userp);
+		return 0;
+	}
+
 	float f_dlnow = dlnow / 1024.f;
 	float f_dltotal = dltotal / 1024.f;
 
-	printf("\r\t\t%.2f/%.2f KB // %.2f KB/s...",
+	LogPrintf("\r\t\t%.2f/%.2f KB // %.2f KB/s...",
 		  f_dlnow, f_dltotal, f_dlnow / (elapsed / 1000.f));
 
 	return 0;
@@ -105,6 +197,8 @@ int DownloadFile(char* url, DownloadType type, void* data, void* userp) {
 	CURL* curl;
 	CURLcode res;
 	xferinfo_data xferdata = {};
+	CountingWriter writer = {};
+	u64 start = gettime();
 
 	curl = curl_easy_init();
 	if (!curl)
@@ -116,38 +210,381 @@ int DownloadFile(char* url, DownloadType type, void* data, void* userp) {
 	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
 	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_cb);
 	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &xferdata);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCounted);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &writer);
 	switch (type) {
 		case DOWNLOAD_BLOB:
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteToBlob);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+			writer.write = WriteToBlob;
+			writer.userp = data;
 			break;
 		case DOWNLOAD_FILE:
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fwrite);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+			writer.write = (fwrite_wannabe)fwrite;
+			writer.userp = data;
 			break;
 		case DOWNLOAD_CUSTOM:
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, (fwrite_wannabe)data);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, userp);
+			writer.write = (fwrite_wannabe)data;
+			writer.userp = userp;
 			break;
 	}
-	ebuffer[0] = '\x00';
-	// printf("\x1b[30;1m	>> %s\x1b[39m\n", url);
-	res = curl_easy_perform(curl);
-	putchar('\n');
+
+#ifdef RECORD
+	mbedtls_sha1_init(&writer.sha);
+	mbedtls_sha1_starts_ret(&writer.sha);
+#endif
+
+	for (int attempt = 0;; attempt++) {
+		curl_off_t offset = writer.written;
+		if (offset)
+			curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, offset);
+
+		xferdata = (xferinfo_data){};
+		ebuffer[0] = '\x00';
+		// LogPrintf("\x1b[30;1m	>> %s\x1b[39m\n", url);
+#ifdef RECORD
+		u64 attempt_start = gettime();
+#endif
+		res = curl_easy_perform(curl);
+		LogPrintf("\n");
+
+#ifdef RECORD
+		long status = 0;
+		unsigned char hash[20];
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		if (res == CURLE_OK)
+			mbedtls_sha1_finish_ret(&writer.sha, hash);
+
+		TraceHTTP(url, status, res, offset, writer.written - offset, attempt_start, res == CURLE_OK ? hash : NULL);
+#endif
+
+		if (res == CURLE_OK || attempt == DOWNLOAD_MAX_RETRIES || !ShouldRetry(curl, res))
+			break;
+
+		LogPrintf("\t\t%s, retrying... (%i/%i)\n", ebuffer[0] ? ebuffer : curl_easy_strerror(res), attempt + 1, DOWNLOAD_MAX_RETRIES);
+		downloadstats.retries++;
+	}
+
 	curl_easy_cleanup(curl);
+#ifdef RECORD
+	mbedtls_sha1_free(&writer.sha);
+#endif
+	downloadstats.files++;
+	downloadstats.time += gettime() - start;
 
 	if (res != CURLE_OK) {
 		if (!ebuffer[0])
 			strcpy(ebuffer, curl_easy_strerror(res));
 
+		downloadstats.failures++;
 		return -res;
 	}
 
 	return res;
 }
 
+// POSTs `body` and collects whatever comes back. headers is NULL-terminated, or NULL.
+int PostData(const char* url, const char* const headers[], const void* body, size_t size, blob* response) {
+	CURL* curl;
+	CURLcode res;
+	struct curl_slist* list = NULL;
+	CountingWriter writer = { WriteToBlob, response };
+	u64 start = gettime();
+
+	curl = curl_easy_init();
+	if (!curl)
+		return -1;
+
+	for (const char* const* header = headers; header && *header; header++)
+		list = curl_slist_append(list, *header);
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, ebuffer);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)size);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCounted);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &writer);
+
+	for (int attempt = 0;; attempt++) {
+		ebuffer[0] = '\x00';
+		// Half a response is no good to anyone, start over. (It's the last allocation, so this reuses it.)
+		response->size = 0;
+		res = curl_easy_perform(curl);
+
+		if (res == CURLE_OK || attempt == DOWNLOAD_MAX_RETRIES || !ShouldRetry(curl, res))
+			break;
+
+		LogPrintf("\t\t%s, retrying... (%i/%i)\n", ebuffer[0] ? ebuffer : curl_easy_strerror(res), attempt + 1, DOWNLOAD_MAX_RETRIES);
+		downloadstats.retries++;
+	}
+
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(list);
+	downloadstats.files++;
+	downloadstats.time += gettime() - start;
+
+	if (res != CURLE_OK) {
+		if (!ebuffer[0])
+			strcpy(ebuffer, curl_easy_strerror(res));
+
+		downloadstats.failures++;
+		return -res;
+	}
+
+	return 0;
+}
+
+static size_t WriteToSegment(void* buffer, size_t size, size_t nmemb, void* userp) {
+	size_t length = size * nmemb;
+	Segment* seg = userp;
+
+	// Only the range we asked for goes in. A 200 is the whole file from the start, so none of it.
+	if (!seg->checked) {
+		long status = 0;
+
+		curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &status);
+		seg->unranged = (status != 206);
+		seg->checked  = true;
+	}
+
+	if (seg->unranged || length > seg->left)
+		return 0;
+
+	memcpy(seg->ptr, buffer, length);
+	seg->ptr    += length;
+	seg->offset += length;
+	seg->left   -= length;
+	downloadstats.bytes += length;
+	return length;
+}
+
+static void StartSegment(CURLM* multi, Segment* seg) {
+	char range[48];
+
+	sprintf(range, "%llu-%llu", seg->offset, seg->offset + seg->left - 1);
+	curl_easy_setopt(seg->curl, CURLOPT_RANGE, range);
+	curl_multi_add_handle(multi, seg->curl);
+
+	seg->from    = seg->offset;
+	seg->started = gettime();
+	seg->busy    = true;
+	seg->checked = false;
+}
+
+// One line in the session trace per attempt at a range, same as DownloadFile does for a whole file.
+static void TraceSegment(const char* url, Segment* seg, CURLcode res) {
+#ifdef RECORD
+	long status = 0;
+	unsigned char hash[20];
+	uint64_t bytes = seg->offset - seg->from;
+
+	curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &status);
+	if (res == CURLE_OK)
+		mbedtls_sha1_ret(seg->ptr - bytes, bytes, hash);
+
+	TraceHTTP(url, status, res, seg->from, bytes, seg->started, res == CURLE_OK ? hash : NULL);
+#endif
+}
+
+static size_t WriteToWindow(void* data, size_t size, size_t nmemb, void* userp) {
+	size_t length = size * nmemb, left = length;
+	WindowWriter* writer = userp;
+
+	if (length > writer->left)
+		return 0;
+
+	while (left) {
+		size_t copy = MIN(left, writer->buffer_size - writer->filled);
+
+		memcpy(writer->buffer + writer->filled, data, copy);
+		writer->filled += copy;
+		writer->left   -= copy;
+		data           += copy;
+		left           -= copy;
+
+		if (writer->filled == writer->buffer_size || !writer->left) {
+			writer->ret = writer->cb(writer->buffer, writer->filled, writer->userp);
+			if (writer->ret < 0)
+				return 0;
+
+			writer->filled = 0;
+		}
+	}
+
+	return length;
+}
+
+/*
+ * Downloads `size` bytes in windows of `buffer_size`. Each window is split into `segments` ranges,
+ * all fetched at once over their own connections, straight into the right place in `buffer`.
+ * cb gets every window in order once it's complete.
+ */
+int DownloadFileSegmented(const char* url, uint64_t size, unsigned segments, unsigned char* buffer, size_t buffer_size,
+						  SegmentCallback cb, void* userp) {
+	int ret = 0;
+	CURLM* multi;
+	Segment segs[DOWNLOAD_MAX_SEGMENTS] = {};
+	bool unranged = false, delivered = false;
+	u64 start = gettime();
+
+	segments = MAX(1, MIN(segments, DOWNLOAD_MAX_SEGMENTS));
+	ebuffer[0] = '\x00';
+
+	multi = curl_multi_init();
+	if (!multi)
+		return -1;
+
+	for (Segment* seg = segs; seg < segs + segments; seg++) {
+		seg->curl = curl_easy_init();
+		if (!seg->curl) {
+			ret = -CURLE_OUT_OF_MEMORY;
+			goto finish;
+		}
+
+		curl_easy_setopt(seg->curl, CURLOPT_URL, url);
+		curl_easy_setopt(seg->curl, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(seg->curl, CURLOPT_WRITEFUNCTION, WriteToSegment);
+		curl_easy_setopt(seg->curl, CURLOPT_WRITEDATA, seg);
+		curl_easy_setopt(seg->curl, CURLOPT_PRIVATE, seg);
+		// Same as xferinfo_cb's "hasn't moved for a while"
+		curl_easy_setopt(seg->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+		curl_easy_setopt(seg->curl, CURLOPT_LOW_SPEED_TIME, 15L);
+	}
+
+	for (uint64_t window = 0; window < size; window += buffer_size) {
+		size_t length = MIN(size - window, buffer_size);
+		size_t per = __builtin_align_up((length + segments - 1) / segments, 0x40);
+		int active = 0;
+
+		for (unsigned i = 0; i < segments && i * per < length; i++) {
+			Segment* seg = segs + i;
+
+			seg->ptr     = buffer + (i * per);
+			seg->offset  = window + (i * per);
+			seg->left    = MIN(per, length - (i * per));
+			seg->retries = 0;
+			StartSegment(multi, seg);
+			active++;
+		}
+
+		while (active) {
+			CURLMsg* msg;
+			int running, queued;
+
+			curl_multi_perform(multi, &running);
+			while ((msg = curl_multi_info_read(multi, &queued))) {
+				Segment* seg;
+				CURLcode res = msg->data.result;
+
+				if (msg->msg != CURLMSG_DONE)
+					continue;
+
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&seg);
+				curl_multi_remove_handle(multi, seg->curl);
+				seg->busy = false;
+				active--;
+
+				if (res == CURLE_OK && seg->left)
+					res = CURLE_PARTIAL_FILE;
+
+				TraceSegment(url, seg, res);
+				if (res == CURLE_OK)
+					continue;
+
+				if (seg->unranged) {
+					strcpy(ebuffer, "The server ignored the Range header");
+					unranged = true;
+					ret = -CURLE_RANGE_ERROR;
+					goto finish;
+				}
+
+				if (seg->retries == DOWNLOAD_MAX_RETRIES || !ShouldRetry(seg->curl, res)) {
+					strcpy(ebuffer, curl_easy_strerror(res));
+					ret = -res;
+					goto finish;
+				}
+
+				// Just this one range, from where it stopped.
+				seg->retries++;
+				downloadstats.retries++;
+				StartSegment(multi, seg);
+				active++;
+			}
+
+			if (active && DownloadCancel) {
+				strcpy(ebuffer, curl_easy_strerror(CURLE_ABORTED_BY_CALLBACK));
+				ret = -CURLE_ABORTED_BY_CALLBACK;
+				goto finish;
+			}
+
+			if (active)
+				curl_multi_poll(multi, NULL, 0, 1000, NULL);
+		}
+
+		u32 elapsed = diff_msec(start, gettime()) ?: 1;
+		if (progress_cb)
+			progress_cb(window + length, size, elapsed, progress_userp);
+		else
+			LogPrintf("\r\t\t%.2f/%.2f KB // %.2f KB/s (%u connections)...", (window + length) / 1024.f, size / 1024.f,
+				   ((window + length) / 1024.f) / (elapsed / 1000.f), segments);
+
+		delivered = true;
+		ret = cb(buffer, length, userp);
+		if (ret < 0)
+			goto finish;
+	}
+
+finish:
+	LogPrintf("\n");
+	for (Segment* seg = segs; seg < segs + segments; seg++) {
+		if (!seg->curl)
+			continue;
+
+		// Cut off because another range failed (or the download was cancelled).
+		if (seg->busy)
+			TraceSegment(url, seg, CURLE_ABORTED_BY_CALLBACK);
+
+		curl_multi_remove_handle(multi, seg->curl);
+		curl_easy_cleanup(seg->curl);
+	}
+
+	curl_multi_cleanup(multi);
+
+	// Nothing's gone to cb yet, so start over as one plain download.
+	if (unranged && !delivered) {
+		LogPrintf("\t\tThe server doesn't do ranges, downloading it in one go.\n");
+
+		WindowWriter writer = { buffer, buffer_size, 0, size, cb, userp };
+		ret = DownloadFile((char*)url, DOWNLOAD_CUSTOM, WriteToWindow, &writer);
+		if (writer.ret < 0)
+			return writer.ret;
+		if (!ret && writer.left)
+			ret = -CURLE_PARTIAL_FILE;
+
+		return ret;
+	}
+
+	downloadstats.files++;
+	downloadstats.time += gettime() - start;
+	if (ret < 0)
+		downloadstats.failures++;
+
+	return ret;
+}
+
+const DownloadStats* GetDownloadStats() {
+	return &downloadstats;
+}
+
+void ResetDownloadStats() {
+	downloadstats = (DownloadStats){};
+}
+
 const char* GetLastDownloadError() {
 	return ebuffer;
 }
 
-
+void SetDownloadProgress(ProgressCallback cb, void* userp) {
+	progress_cb    = cb;
+	progress_userp = userp;
+}
@@ -1,4 +1,6 @@
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <wiisocket.h>
 
 typedef struct {
@@ -6,6 +8,14 @@ typedef struct {
 	size_t size;
 } blob;
 
+typedef struct {
+	uint64_t bytes;
+	uint64_t time; // ticks spent in DownloadFile
+	uint32_t files;
+	uint32_t retries;
+	uint32_t failures;
+} DownloadStats;
+
 typedef enum {
 	DOWNLOAD_BLOB,
 	DOWNLOAD_FILE,
@@ -18,5 +28,21 @@ extern long gethostid(void);
 int network_init();
 char* PrintIPAddress();
 void network_deinit();
+int PostData(const char* url, const char* const headers[], const void* body, size_t size, blob* response);
+
+// Instead of the "x/y KB // z KB/s" line. Called from inside curl, so keep it short.
+typedef void (*ProgressCallback)(uint64_t now, uint64_t total, uint32_t elapsed_ms, void* userp);
+
+// Set it and whatever's downloading gives up as soon as it can (-CURLE_ABORTED_BY_CALLBACK), no retries.
+extern volatile bool DownloadCancel;
+
+typedef int (*SegmentCallback)(unsigned char* data, size_t length, void* userp);
+
 int DownloadFile(char* url, DownloadType, void*, void*);
+int DownloadFileSegmented(const char* url, uint64_t size, unsigned segments, unsigned char* buffer, size_t buffer_size,
+						  SegmentCallback cb, void* userp);
+size_t WriteToBlob(void* buffer, size_t size, size_t nmemb, void* userp);
 const char* GetLastDownloadError();
+const DownloadStats* GetDownloadStats();
+void ResetDownloadStats();
+void SetDownloadProgress(ProgressCallback cb, void* userp);
@@ -1,98 +1,318 @@
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/param.h>
 #include <curl/curl.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <ogc/es.h>
 #include <mbedtls/aes.h>
 #include <mbedtls/sha1.h>
+#include <ogc/lwp_watchdog.h>
 
 #include "nus.h"
-#include "crypto.h"
-#include "malloc.h"
+#include "arena.h"
+#include "memprof.h"
 #include "network.h"
 #include "nand.h"
+#include "journal.h"
+#include "signcache.h"
+#include "snapshot.h"
+#include "tune.h"
+#include "log.h"
+#include "trace.h"
 
 #define NUS_SERVER "nus.cdn.shop.wii.com"
-typedef struct {
-	uint32_t cid;
-	uint32_t _padding;
-	sha1 hash;
-} SharedContent;
 
-int GetInstalledTitle(int64_t titleID, struct Title* title) {
+static char nus_server[96] = "http://" NUS_SERVER;
+static char nus_peer[96];
+static char staging_dir[64];
+static char snapshot_dir[64];
+
+/*
+ * Contents at least this big are downloaded over NUSDownloadSegments connections at once. 4 gets a capped
+ * connection to about 2.5x a single stream. Past that, the ranges in a 512 KB window get small, and it's
+ * the link (not the per-connection cap) that runs out first.
+ */
+#define SEGMENTED_MIN_SIZE (1 << 20)
+unsigned NUSDownloadSegments = 4;
+static StagingMode staging = STAGING_OFF;
+static InstallPlan* planning = NULL;
+static Snapshot* restoring = NULL; // InstallTitle takes a local title's contents from here instead
+static bool peer_skipped = false; // for the rest of this title, see RestartContent
+
+// ES wouldn't open a content again after the peer got partway through it, so the title starts over.
+#define RESTART_TITLE (-EAGAIN)
+typedef struct {
+	int cfd;
+	unsigned char* buffer;
+	size_t filled;
 	int ret;
-	char filepath[30];
+	uint64_t written; // everything it was handed, sent to ES or not
+} ContentStream;
 
-	memset(title, 0, sizeof(struct Title));
+// NULL for the real thing.
+void SetNUSServer(const char* server) {
+	strncpy(nus_server, server ?: "http://" NUS_SERVER, sizeof(nus_server) - 1);
+}
 
-	strcpy(filepath, "/sys/cert.sys");
-	ret = NANDReadFileSimple(filepath, sizeof(RetailCerts), (unsigned char**)&title->certs, NULL);
-	if (ret < 0)
-		return ret;
+const char* GetNUSServer(void) {
+	return nus_server;
+}
 
-	ret = GetStoredTMD(titleID, &title->s_tmd, &title->tmd_size);
-	if (ret < 0)
-		return ret;
+// Another console serving its cache (see serve.h). Tried before the server, NULL to stop.
+void SetNUSPeer(const char* peer) {
+	strncpy(nus_peer, peer ?: "", sizeof(nus_peer) - 1);
+}
 
-	title->tmd = SIGNATURE_PAYLOAD(title->s_tmd);
+const char* GetNUSPeer(void) {
+	return nus_peer[0] ? nus_peer : NULL;
+}
+
+static const char* FirstServer(void) {
+	return (nus_peer[0] && !peer_skipped) ? nus_peer : nus_server;
+}
+
+static const char* NextServer(const char* server) {
+	return server == nus_peer ? nus_server : NULL;
+}
 
-	sprintf(filepath, "/ticket/%08x/%08x.tik", (uint32_t)(titleID >> 32), (uint32_t)titleID);
-	ret = NANDReadFileSimple(filepath, STD_SIGNED_TIK_SIZE, (unsigned char**)&title->s_tik, &title->tik_size);
+/*
+ * The peer doesn't have it (or went away), so go ask the real server. It can go away halfway through,
+ * so whatever it did get through has to go first, the server's copy starts from the top.
+ */
+static bool PeerMissed(const char* server, int ret) {
+	if (server != nus_peer)
+		return false;
+
+	switch (-ret) {
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+			LogPrintf("\t>> Can't reach %s anymore, not asking it again.\n", nus_peer);
+			nus_peer[0] = 0;
+			return true;
+
+		case CURLE_HTTP_RETURNED_ERROR:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+// dir is laid out like NUS: <dir>/<title ID>/{tmd, tmd.<rev>, cetk, <content ID>}
+void SetStaging(StagingMode mode, const char* dir) {
+	staging = dir ? mode : STAGING_OFF;
+	if (dir)
+		strncpy(staging_dir, dir, sizeof(staging_dir) - 1);
+}
+
+void SetSnapshotDir(const char* dir) {
+	snapshot_dir[0] = '\x00';
+	if (dir)
+		strncpy(snapshot_dir, dir, sizeof(snapshot_dir) - 1);
+}
+
+// While this is set, InstallTitle only adds up what it would do. NULL to go back to installing.
+void PlanInstalls(InstallPlan* plan) {
+	planning = plan;
+}
+
+static int StagedFilePath(char* path, int64_t titleID, const char* name) {
+	sprintf(path, "%s/%016llx", staging_dir, titleID);
+	if (mkdir(staging_dir, 0777) < 0 && errno != EEXIST)
+		return -errno;
+	if (mkdir(path, 0777) < 0 && errno != EEXIST)
+		return -errno;
+
+	strcat(path, "/");
+	strcat(path, name);
+	return 0;
+}
+
+// Keeps a copy of the metadata as it came from the server.
+static void StageMeta(int64_t titleID, const char* name, blob* data) {
+	char path[128];
+
+	if (staging != STAGING_DOWNLOAD || StagedFilePath(path, titleID, name) < 0)
+		return;
+
+	FILE* fp = fopen(path, "wb");
+	if (!fp)
+		return;
+
+	bool ok = fwrite(data->ptr, 1, data->size, fp) == data->size;
+	if (!fclose(fp) && ok)
+		JournalMeta(titleID, name);
+}
+
+// What StageMeta kept, if this batch already got it. Same as downloading it again, just quicker.
+static int ReadStagedMeta(int64_t titleID, const char* name, blob* data) {
+	char path[128];
+
+	if (staging == STAGING_OFF || !JournalHasMeta(titleID, name))
+		return -ENOENT;
+
+	sprintf(path, "%s/%016llx/%s", staging_dir, titleID, name);
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return -errno;
+
+	fseek(fp, 0, SEEK_END);
+	data->size = ftell(fp);
+	data->ptr  = ArenaAlloc(data->size);
+	rewind(fp);
+
+	int ret = (data->ptr && fread(data->ptr, 1, data->size, fp) == data->size) ? 0 : -EIO;
+	fclose(fp);
+	return ret;
+}
+
+// Header only: version and content list, without hashes. Straight from ES, no TMD to read in.
+static int LoadTitleView(struct Title* title) {
+	int ret;
+	uint32_t size = 0;
+
+	ret = ES_GetTMDViewSize(title->id, &size);
 	if (ret < 0)
 		return ret;
 
-	title->ticket = SIGNATURE_PAYLOAD(title->s_tik);
+	title->view = ArenaAlloc(size);
+	if (!title->view)
+		return -ENOMEM;
+
+	return ES_GetTMDView(title->id, (u8*)title->view, size);
+}
+
+int LoadInstalledTitle(struct Title* title, TitleTier tier) {
+	int ret = 0;
+	char filepath[30];
 
-	GetTitleKey(title->ticket, title->key);
+	MemProfSetPhase(MEMPHASE_METADATA);
 
+	if (tier == TITLE_VIEW && !title->view && !title->tmd) {
+		ret = LoadTitleView(title);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (tier >= TITLE_TMD && !title->tmd) {
+		ret = GetStoredTMD(title->id, &title->s_tmd, &title->tmd_size);
+		if (ret < 0)
+			return ret;
+
+		title->tmd = SIGNATURE_PAYLOAD(title->s_tmd);
+	}
+
+	if (tier >= TITLE_FULL && !title->ticket) {
+		strcpy(filepath, "/sys/cert.sys");
+		ret = NANDReadFileSimple(filepath, sizeof(RetailCerts), (unsigned char**)&title->certs, NULL);
+		if (ret < 0)
+			return ret;
+
+		sprintf(filepath, "/ticket/%08x/%08x.tik", (uint32_t)(title->id >> 32), (uint32_t)title->id);
+		ret = NANDReadFileSimple(filepath, STD_SIGNED_TIK_SIZE, (unsigned char**)&title->s_tik, &title->tik_size);
+		if (ret < 0)
+			return ret;
+
+		title->ticket = SIGNATURE_PAYLOAD(title->s_tik);
+
+		TitleCryptoInit(&title->crypto, title->ticket);
+	}
+
+	return ret;
+}
+
+int GetInstalledTitleTier(int64_t titleID, TitleTier tier, struct Title* title) {
+	memset(title, 0, sizeof(struct Title));
+	title->mark = ArenaMark();
 	title->id = titleID;
 	title->local = true;
-	return 0;
+
+	int ret = LoadInstalledTitle(title, tier);
+	if (ret < 0) {
+		ArenaRelease(title->mark);
+		memset(title, 0, sizeof(struct Title));
+	}
+
+	return ret;
+}
+
+int GetInstalledTitle(int64_t titleID, struct Title* title) {
+	return GetInstalledTitleTier(titleID, TITLE_FULL, title);
+}
+
+uint16_t TitleVersion(const struct Title* title) {
+	return title->tmd ? title->tmd->title_version : title->view->title_version;
 }
 
 int DownloadTitleMeta(int64_t titleID, int titleRev, struct Title* title) {
 	int ret;
-	char url[120];
+	char url[192], name[16];
 	blob meta = {}, cetk = {};
 
 	memset(title, 0, sizeof(struct Title));
+	title->mark = ArenaMark();
+	MemProfSetPhase(MEMPHASE_METADATA);
 
-	sprintf(url, "http://" NUS_SERVER "/ccs/download/%016llx/", titleID);
-
-	title->certs = memalign32(sizeof(RetailCerts));
+	title->certs = ArenaAlloc(sizeof(RetailCerts));
 	if (!title->certs)
 		return -ENOMEM;
 
 	memset(title->certs, 0, sizeof(RetailCerts));
 
 	if (titleRev > 0)
-		sprintf(strrchr(url, '/'), "/tmd.%hu", (uint16_t)titleRev);
+		sprintf(name, "tmd.%hu", (uint16_t)titleRev);
 	else
-		strcpy (strrchr(url, '/'), "/tmd");
+		strcpy (name, "tmd");
+
+	LogPrintf("	>> Downloading TMD...\n");
+	if (ReadStagedMeta(titleID, name, &meta) < 0) {
+		for (const char* server = FirstServer(); server; server = NextServer(server)) {
+			sprintf(url, "%s/ccs/download/%016llx/%s", server, titleID, name);
+			ret = DownloadFile(url, DOWNLOAD_BLOB, &meta, NULL);
+			if (!PeerMissed(server, ret))
+				break;
 
-	puts("	>> Downloading TMD...");
-	ret = DownloadFile(url, DOWNLOAD_BLOB, &meta, NULL);
-	if (ret < 0)
-		goto fail;
+			meta.size = 0;
+		}
+		if (ret < 0)
+			goto fail;
+
+		StageMeta(titleID, name, &meta);
+	}
 
 	title->s_tmd = meta.ptr;
 	title->tmd_size = SIGNED_TMD_SIZE(title->s_tmd);
 	title->tmd = SIGNATURE_PAYLOAD(title->s_tmd);
 	PickUpTaggedCerts(meta.ptr + title->tmd_size, meta.size - title->tmd_size, title->certs);
 
-	puts("	>> Downloading ticket...");
-	sprintf(strrchr(url, '/'), "/cetk");
-	ret = DownloadFile(url, DOWNLOAD_BLOB, &cetk, NULL);
-	if (ret < 0)
-		goto fail;
+	LogPrintf("	>> Downloading ticket...\n");
+	if (ReadStagedMeta(titleID, "cetk", &cetk) < 0) {
+		for (const char* server = FirstServer(); server; server = NextServer(server)) {
+			sprintf(url, "%s/ccs/download/%016llx/cetk", server, titleID);
+			ret = DownloadFile(url, DOWNLOAD_BLOB, &cetk, NULL);
+			if (!PeerMissed(server, ret))
+				break;
+
+			cetk.size = 0;
+		}
+		if (ret < 0)
+			goto fail;
+
+		StageMeta(titleID, "cetk", &cetk);
+	}
 
 	title->s_tik = cetk.ptr;
 	title->tik_size = STD_SIGNED_TIK_SIZE;
 	title->ticket = SIGNATURE_PAYLOAD(title->s_tik);
 	PickUpTaggedCerts(cetk.ptr + title->tik_size, cetk.size - title->tik_size, title->certs);
 
-	GetTitleKey(title->ticket, title->key);
+	TitleCryptoInit(&title->crypto, title->ticket);
 
 	title->id = titleID;
 
@@ -104,16 +324,8 @@ fail:
 }
 
 void ChangeTitleID(struct Title* title, int64_t new) {
-	mbedtls_aes_context aes = {};
-	aesiv iv = {};
-	uint8_t cindex = title->ticket->reserved[0xb];
-	if (cindex > 2)
-		cindex = 0;
-
-	iv.titleid = new;
-	mbedtls_aes_setkey_enc(&aes, CommonKeys[cindex], 128);
-	mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, sizeof(aeskey), iv.full, title->key, title->ticket->cipher_title_key);
 	title->ticket->titleid = new;
+	TitleCryptoWrap(&title->crypto, title->ticket, title->ticket->reserved[0xb]);
 
 	title->tmd->title_id = new;
 
@@ -121,14 +333,15 @@ void ChangeTitleID(struct Title* title, int64_t new) {
 
 static int PurgeTitle(int64_t titleid) {
 	int ret;
+	size_t mark = ArenaMark();
 	uint32_t viewcnt = 0;
 	tikview* views, view ATTRIBUTE_ALIGN(0x20);
 
-	ret = ES_DeleteTitleContent(titleid);
+	ret = ES->DeleteTitleContent(titleid);
 	if (ret && ret != -106)
 		return ret;
 
-	ret = ES_DeleteTitle(titleid);
+	ret = ES->DeleteTitle(titleid);
 	if (ret && ret != -106)
 		return ret;
 
@@ -139,150 +352,738 @@ static int PurgeTitle(int64_t titleid) {
 	if (!viewcnt)
 		return ENOENT;
 
-	views = memalign32(sizeof(tikview) * viewcnt);
+	views = ArenaAlloc(sizeof(tikview) * viewcnt);
 	if (!views)
 		return -ENOMEM;
 
 	ret = ES_GetTicketViews(titleid, views, viewcnt);
 	if (ret < 0)
-		return ret;
+		goto finish;
 
 	for (int i = 0; i < viewcnt; i++) {
 		view = views[i];
-		ret = ES_DeleteTicket(&view);
+		ret = ES->DeleteTicket(&view);
 		if (ret < 0)
 			break;
 	}
-	free(views);
 
+finish:
+	ArenaRelease(mark);
 	return ret;
 }
 
-int InstallTitle(struct Title* title, bool purge) {
+// In whatever size ES takes fastest on this console, and timed, so real installs keep tuning it.
+static int AddContentData(int cfd, unsigned char* data, uint32_t length) {
+	int ret = 0;
+	uint32_t chunk = TuneChunk(TUNE_ES_WRITE);
+
+	for (uint32_t offset = 0; offset < length; offset += chunk) {
+		uint32_t size = MIN(length - offset, chunk);
+		uint64_t start = gettime();
+
+		ret = ES->AddContentData(cfd, data + offset, size);
+		if (ret < 0)
+			break;
+
+		if (ES == &ESNative)
+			TuneRecord(TUNE_ES_WRITE, size, gettime() - start);
+	}
+
+	return ret;
+}
+
+static size_t WriteToContent(void* buffer, size_t size, size_t nmemb, void* userp) {
+	size_t length = size * nmemb, left = length;
+	ContentStream* stream = userp;
+
+	stream->written += length;
+	while (left) {
+		size_t copy = MIN(left, ArenaBufferSize() - stream->filled);
+
+		memcpy(stream->buffer + stream->filled, buffer, copy);
+		stream->filled += copy;
+		buffer         += copy;
+		left           -= copy;
+
+		if (stream->filled == ArenaBufferSize()) {
+			stream->ret = AddContentData(stream->cfd, stream->buffer, stream->filled);
+			if (stream->ret < 0)
+				return 0;
+
+			stream->filled = 0;
+		}
+	}
+
+	return length;
+}
+
+static int WriteWindowToContent(unsigned char* data, size_t length, void* userp) {
+	ContentStream* stream = userp;
+
+	stream->written += length;
+	return AddContentData(stream->cfd, data, length);
+}
+
+/*
+ * ES can't take back what it already has, so finish it (the hash won't match, that's the point) and open
+ * the content again. If ES won't have that, the whole title has to start over, without the peer.
+ */
+static int RestartContent(struct Title* title, tmd_content* content, ContentStream* stream) {
+	bool sent = stream->written > stream->filled;
+
+	stream->filled  = 0;
+	stream->written = 0;
+	stream->ret     = 0;
+	if (!sent)
+		return stream->cfd;
+
+	int ret = ES->AddContentFinish(stream->cfd);
+	stream->cfd = ES->AddContentStart(title->tmd->title_id, content->cid);
+	if (stream->cfd < 0) {
+		LogPrintf("\t>> ES won't open content #%u again (%i, then %i).\n", content->index, ret, stream->cfd);
+		peer_skipped = true;
+		return RESTART_TITLE;
+	}
+
+	return stream->cfd;
+}
+
+static int WriteWindowToFile(unsigned char* data, size_t length, void* userp) {
+	return (fwrite(data, 1, length, userp) == length) ? 0 : -EIO;
+}
+
+// cfd is started over if the peer got partway, so it might not be the same one after.
+static int AddDownloadedContent(struct Title* title, tmd_content* content, int* cfd) {
 	int ret;
-	signed_blob* s_buffer = NULL;
-	SharedContent* sharedContents = NULL;
-	uint32_t sharedContentsCount = 0;
+	char url[192];
+	ContentStream stream;
 
-	if (title->ticket->reserved[0xb] != 0) {
-		ChangeCommonKey(title->ticket, 0);
-		Fakesign(title);
+	MemProfSetPhase(MEMPHASE_DOWNLOAD);
+	stream = (ContentStream){ *cfd, ArenaGetBuffer() };
+
+	if (!stream.buffer)
+		return -ENOMEM;
+
+	for (const char* server = FirstServer(); server; server = NextServer(server)) {
+		sprintf(url, "%s/ccs/download/%016llx/%08x", server, title->id, content->cid);
+		if (NUSDownloadSegments > 1 && content->size >= SEGMENTED_MIN_SIZE)
+			ret = DownloadFileSegmented(url, __builtin_align_up(content->size, 0x10), NUSDownloadSegments,
+										stream.buffer, ArenaBufferSize(), WriteWindowToContent, &stream);
+		else
+			ret = DownloadFile(url, DOWNLOAD_CUSTOM, WriteToContent, &stream);
+
+		if (!PeerMissed(server, ret))
+			break;
+
+		if (stream.written && (ret = RestartContent(title, content, &stream)) < 0)
+			break;
 	}
 
-	if (purge) {
-		ret = PurgeTitle(title->tmd->title_id);
+	*cfd = stream.cfd;
+	if (stream.ret < 0)
+		ret = stream.ret;
+	else if (!ret && stream.filled)
+		ret = AddContentData(stream.cfd, stream.buffer, stream.filled);
+
+	ArenaPutBuffer(stream.buffer);
+	return ret;
+}
+
+// Staged contents are stored encrypted, exactly as they come from NUS. Decrypt and hash to check them.
+static int CheckStagedContent(struct Title* title, tmd_content* content, const char* path) {
+	int ret = 0;
+	mbedtls_aes_context* aes = TitleCryptoSchedule(&title->crypto, MBEDTLS_AES_DECRYPT);
+	mbedtls_sha1_context sha;
+	aesiv iv = ContentIV(content->index);
+	sha1 hash;
+	unsigned char* buffer;
+
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return -errno;
+
+	buffer = ArenaGetBuffer();
+	if (!buffer) {
+		fclose(fp);
+		return -ENOMEM;
+	}
+
+	mbedtls_sha1_init(&sha);
+	mbedtls_sha1_starts_ret(&sha);
+
+	for (uint64_t left = content->size; left;) {
+		size_t length = MIN(left, ArenaBufferSize());
+		size_t align_length = __builtin_align_up(length, 0x10);
+
+		if (fread(buffer, 1, align_length, fp) != align_length) {
+			ret = -EIO;
+			break;
+		}
+
+		ret = CryptAndHash(aes, MBEDTLS_AES_DECRYPT, align_length, length, iv.full, buffer, buffer, &sha);
 		if (ret < 0)
-			goto finish;
+			break;
+
+		left -= length;
 	}
 
-	ret = NANDReadFileSimple("/shared1/content.map", 0, (unsigned char**)&sharedContents, &sharedContentsCount);
+	mbedtls_sha1_finish_ret(&sha, hash);
+	mbedtls_sha1_free(&sha);
+	ArenaPutBuffer(buffer);
+	fclose(fp);
+
+	if (!ret && memcmp(hash, content->hash, sizeof(sha1)))
+		ret = -EIO;
+
+	return ret;
+}
+
+static int StageContent(struct Title* title, tmd_content* content) {
+	int ret;
+	char url[192], name[9], path[128], partpath[136];
+	struct stat st;
+
+	sprintf(name, "%08x", content->cid);
+	ret = StagedFilePath(path, title->id, name);
 	if (ret < 0)
-		goto finish;
+		return ret;
 
-	sharedContentsCount /= sizeof(SharedContent);
+	// Checked on an earlier run, no need to decrypt the whole thing again.
+	if (JournalHasContent(title->id, content->cid, content->hash) && !stat(path, &st)
+	&& st.st_size == __builtin_align_up(content->size, 0x10)) {
+		LogPrintf("	>> Content #%u is already staged.\n", content->index);
+		return 0;
+	}
 
-	s_buffer = memalign32(MAX(title->tmd_size, title->tik_size));
-	if (!s_buffer) {
-		ret = -ENOMEM;
-		goto finish;
+	if (CheckStagedContent(title, content, path) == 0) {
+		JournalContent(title->id, content->cid, content->hash);
+		LogPrintf("	>> Content #%u is already staged.\n", content->index);
+		return 0;
+	}
+
+	sprintf(partpath, "%s.part", path);
+	FILE* fp = fopen(partpath, "wb");
+	if (!fp)
+		return -errno;
+
+	LogPrintf("	>> Downloading content #%u...\n", content->index);
+	for (const char* server = FirstServer(); server; server = NextServer(server)) {
+		sprintf(url, "%s/ccs/download/%016llx/%08x", server, title->id, content->cid);
+		if (NUSDownloadSegments > 1 && content->size >= SEGMENTED_MIN_SIZE) {
+			unsigned char* buffer = ArenaGetBuffer();
+
+			ret = buffer ? DownloadFileSegmented(url, __builtin_align_up(content->size, 0x10), NUSDownloadSegments,
+												 buffer, ArenaBufferSize(), WriteWindowToFile, fp) : -ENOMEM;
+			ArenaPutBuffer(buffer);
+		}
+		else {
+			ret = DownloadFile(url, DOWNLOAD_FILE, fp, NULL);
+		}
+
+		if (!PeerMissed(server, ret))
+			break;
+
+		if (!freopen(partpath, "wb", fp)) {
+			ret = -errno;
+			fp = NULL;
+			break;
+		}
+	}
+	if (fp)
+		fclose(fp);
+
+	if (!ret) {
+		ret = CheckStagedContent(title, content, partpath);
+		if (ret < 0)
+			LogPrintf("	>> Content #%u came out corrupted! (%i)\n", content->index, ret);
+	}
+
+	if (!ret) {
+		remove(path);
+		if (rename(partpath, path) < 0)
+			ret = -errno;
+		else
+			JournalContent(title->id, content->cid, content->hash);
 	}
 
-	puts("	>> Installing ticket...");
-	memcpy(s_buffer, title->s_tik, title->tik_size);
-	ret = ES_AddTicket(s_buffer, title->tik_size, (signed_blob*)title->certs, sizeof(RetailCerts), NULL, 0);
 	if (ret < 0)
-		goto finish;
+		remove(partpath);
+
+	return ret;
+}
+
+// Already checked when it was staged, and ES checks the hash again anyway.
+static int AddStagedContent(struct Title* title, tmd_content* content, int cfd) {
+	int ret = 0;
+	char path[128];
+	unsigned char* buffer;
 
-	puts("	>> Installing TMD...");
-	memcpy(s_buffer, title->s_tmd, title->tmd_size);
-	ret = ES_AddTitleStart(s_buffer, title->tmd_size, (signed_blob*)title->certs, sizeof(RetailCerts), NULL, 0);
+	sprintf(path, "%s/%016llx/%08x", staging_dir, title->id, content->cid);
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return -ENOENT;
+
+	buffer = ArenaGetBuffer();
+	if (!buffer) {
+		fclose(fp);
+		return -ENOMEM;
+	}
+
+	for (uint64_t left = __builtin_align_up(content->size, 0x10); left;) {
+		size_t length = MIN(left, ArenaBufferSize());
+
+		if (fread(buffer, 1, length, fp) != length) {
+			ret = -EIO;
+			break;
+		}
+
+		ret = AddContentData(cfd, buffer, length);
+		if (ret < 0)
+			break;
+
+		left -= length;
+	}
+
+	ArenaPutBuffer(buffer);
+	fclose(fp);
+	return ret;
+}
+
+static bool IsStaged(struct Title* title, tmd_content* content) {
+	char path[128];
+	struct stat st;
+
+	if (!staging_dir[0])
+		return false;
+
+	sprintf(path, "%s/%016llx/%08x", staging_dir, title->id, content->cid);
+	return !stat(path, &st) && st.st_size == __builtin_align_up(content->size, 0x10);
+}
+
+static int PlanTitle(struct Title* title) {
+	int ret;
+	size_t mark = ArenaMark();
+	SharedContentLookup shared = { title->tmd };
+	char path[ISFS_MAXPATH];
+	uint32_t clusters, inodes;
+
+	ret = LookupSharedContents(&shared);
 	if (ret < 0)
 		goto finish;
 
-	free(s_buffer);
-	s_buffer = NULL;
+	// Not installed yet, so it needs its directories, TMD and ticket too. (title/<lo>, content, data, title.tmd, <lo>.tik)
+	sprintf(path, "/title/%08x/%08x", (uint32_t)(title->tmd->title_id >> 32), (uint32_t)title->tmd->title_id);
+	if (ISFS_GetUsage(path, &clusters, &inodes) < 0) {
+		planning->inodes   += 5;
+		planning->clusters += 2;
+	}
 
+	planning->titles++;
 	for (int i = 0; i < title->tmd->num_contents; i++) {
 		tmd_content* content = title->tmd->contents + i;
-		char path[120];
-		void* buffer = NULL;
 
 		if (content->type & 0x8000) {
 			if (title->local) continue;
 
-			bool found = false;
-			for (SharedContent* s_content = sharedContents; s_content < sharedContents + sharedContentsCount; s_content++)
-				if (memcmp(s_content->hash, content->hash, sizeof(sha1)) == 0) { found = true; break; }
-
-			if (found) continue;
+			if (SharedContentFound(&shared, i)) continue;
 		}
 
-		printf("	>> Installing content #%u...\n", content->index);
-		int cfd = ret = ES_AddContentStart(title->tmd->title_id, content->cid);
+		planning->contents++;
+		planning->nand     += content->size;
+		planning->clusters += (content->size + NAND_CLUSTER_SIZE - 1) / NAND_CLUSTER_SIZE;
+		planning->inodes++;
+
+		if (!title->local && !IsStaged(title, content))
+			planning->download += __builtin_align_up(content->size, 0x10);
+	}
+
+finish:
+	ArenaRelease(mark);
+	return ret;
+}
+
+// Downloads (and checks) everything InstallTitle would, without touching ES.
+static int StageTitle(struct Title* title) {
+	int ret;
+	size_t mark = ArenaMark();
+	SharedContentLookup shared = { title->tmd };
+
+	if (title->local)
+		return 0;
+
+	ret = LookupSharedContents(&shared);
+	if (ret < 0)
+		goto finish;
+
+	MemProfSetPhase(MEMPHASE_DOWNLOAD);
+	for (int i = 0; i < title->tmd->num_contents; i++) {
+		tmd_content* content = title->tmd->contents + i;
+
+		if ((content->type & 0x8000) && SharedContentFound(&shared, i)) continue;
+
+		ret = StageContent(title, content);
 		if (ret < 0)
 			break;
+	}
+
+finish:
+	ArenaRelease(mark);
+	return ret;
+}
+
+typedef struct {
+	TitleCrypto* crypto;
+	HashContext sha;
+	aesiv iv;
+	int cfd;
+} LocalContentStream;
+
+static int EncryptLocalContent(unsigned char* chunk, uint32_t length, uint32_t offset, void* userp) {
+	LocalContentStream* stream = userp;
+	uint32_t align_length = __builtin_align_up(length, 0x10);
+	int ret;
 
-		if (title->local) {
-			size_t align_csize = __builtin_align_up(content->size, 0x10);
+	// The last chunk gets padded out to the AES block size.
+	memset(chunk + length, 0, align_length - length);
+	if (stream->sha.hardware) {
+		// Starlet does both, the PPC just waits.
+		ret = HashUpdate(&stream->sha, chunk, length);
+		if (ret < 0)
+			return ret;
 
-			sprintf(path, "/title/%08x/%08x/content/%08x.app", (uint32_t)(title->id >> 32), (uint32_t)title->id, content->cid);
+		ret = AESCryptCBC(stream->crypto, MBEDTLS_AES_ENCRYPT, align_length, stream->iv.full, chunk, chunk);
+	}
+	else {
+		ret = CryptAndHash(TitleCryptoSchedule(stream->crypto, MBEDTLS_AES_ENCRYPT), MBEDTLS_AES_ENCRYPT, align_length, length, stream->iv.full, chunk, chunk, &stream->sha.sw);
+	}
+	if (ret < 0)
+		return ret;
 
-			ret = NANDReadFileSimple(path, content->size, (unsigned char**)&buffer, NULL);
-			if (ret < 0)
-				break;
+	return AddContentData(stream->cfd, chunk, align_length);
+}
+
+static int AddLocalContent(struct Title* title, tmd_content* content, int cfd) {
+	int ret;
+	char path[ISFS_MAXPATH];
+	NANDStream nand;
+	LocalContentStream stream = { &title->crypto, .iv = ContentIV(content->index), .cfd = cfd };
+
+	MemProfSetPhase(MEMPHASE_REENCRYPT);
+
+	sprintf(path, "/title/%08x/%08x/content/%08x.app", (uint32_t)(title->id >> 32), (uint32_t)title->id, content->cid);
+	ret = NANDStreamOpen(&nand, path);
+	if (ret < 0)
+		return ret;
+
+	if (nand.size < content->size) {
+		NANDStreamClose(&nand);
+		return -EIO;
+	}
+
+	// Shower thought: just use ES_ExportContentData
+	HashInit(&stream.sha, content->size);
+
+	nand.size = content->size;
+	ret = NANDStreamRun(&nand, 0, EncryptLocalContent, &stream);
+	NANDStreamClose(&nand);
+
+	// ES would catch it in ES_AddContentFinish too, but this is a lot clearer.
+	if (!CheckHashFinish(&stream.sha, content->hash) && ret >= 0) {
+		LogPrintf("	>> Local copy of content #%u is corrupted!\n", content->index);
+		ret = -EIO;
+	}
 
-			mbedtls_aes_context aes = {};
-			aesiv iv = { content->index };
+	return ret;
+}
+
+static int AddSnapshotContent(struct Title* title, tmd_content* content, int cfd) {
+	int ret = 0;
+	LocalContentStream stream = { &title->crypto, .iv = ContentIV(content->index), .cfd = cfd };
+	unsigned char* buffer = ArenaGetBuffer();
+
+	if (!buffer)
+		return -ENOMEM;
+
+	MemProfSetPhase(MEMPHASE_REENCRYPT);
+	HashInit(&stream.sha, content->size);
+
+	for (uint64_t offset = 0; offset < content->size;) {
+		uint32_t length = MIN(content->size - offset, ArenaBufferSize());
+
+		ret = SnapshotRead(restoring, buffer, length);
+		if (ret < 0)
+			break;
+
+		ret = EncryptLocalContent(buffer, length, offset, &stream);
+		if (ret < 0)
+			break;
+
+		offset += length;
+	}
+
+	ArenaPutBuffer(buffer);
+	if (!CheckHashFinish(&stream.sha, content->hash) && ret >= 0)
+		ret = -EIO;
+
+	return ret;
+}
+
+static void SnapshotPath(int64_t titleID, char* path) {
+	sprintf(path, "%s/%016llx.snap", snapshot_dir, titleID);
+}
+
+static int SnapshotContent(unsigned char* chunk, uint32_t length, uint32_t offset, void* userp) {
+	return SnapshotWrite(userp, chunk, length);
+}
+
+// Before a purge, see snapshot.h.
+static int SnapshotTitle(int64_t titleID) {
+	int ret;
+	char path[96], cpath[ISFS_MAXPATH];
+	struct stat st;
+	struct Title local;
+	Snapshot snap;
+
+	SnapshotPath(titleID, path);
+
+	/*
+	 * Left over from a run that purged the title and couldn't put it back. Whatever's on the NAND now is
+	 * what that run left half-installed (or nothing), so the leftover is the last good copy. Keep it.
+	 */
+	if (stat(path, &st) == 0)
+		return 0;
+
+	if (mkdir(snapshot_dir, 0777) < 0 && errno != EEXIST)
+		return -errno;
+
+	ret = GetInstalledTitle(titleID, &local);
+	if (ret < 0)
+		return ret;
+
+	ret = SnapshotCreate(&snap, path);
+	if (ret < 0)
+		goto finish;
+
+	SnapshotHeader header = { SNAPSHOT_MAGIC, titleID, local.tmd_size, local.tik_size };
+	for (int i = 0; i < local.tmd->num_contents; i++) {
+		if (!(local.tmd->contents[i].type & 0x8000))
+			header.num_contents++;
+	}
 
-			// Shower thought: just use ES_ExportContentData
-			mbedtls_aes_setkey_enc(&aes, title->key, 128);
-			mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, align_csize, iv.full, buffer, buffer);
+	ret = SnapshotWrite(&snap, &header, sizeof(header));
+	if (ret >= 0)
+		ret = SnapshotWrite(&snap, local.s_tmd, local.tmd_size);
+	if (ret >= 0)
+		ret = SnapshotWrite(&snap, local.s_tik, local.tik_size);
 
-			ret = ES_AddContentData(cfd, buffer, align_csize);
-			free(buffer);
+	for (int i = 0; ret >= 0 && i < local.tmd->num_contents; i++) {
+		tmd_content* content = local.tmd->contents + i;
+		NANDStream nand;
+
+		if (content->type & 0x8000) continue;
+
+		sprintf(cpath, "/title/%08x/%08x/content/%08x.app", (uint32_t)(titleID >> 32), (uint32_t)titleID, content->cid);
+		ret = NANDStreamOpen(&nand, cpath);
+		if (ret < 0)
+			break;
+
+		if (nand.size < content->size) {
+			NANDStreamClose(&nand);
+			ret = -EIO;
+			break;
 		}
-		else {
-			blob cdownload = { memalign32(0x20) };
 
-			sprintf(path, "http://" NUS_SERVER "/ccs/download/%016llx/%08x", title->id, content->cid);
-			ret = DownloadFile(path, DOWNLOAD_BLOB, &cdownload, NULL);
-			if (ret != 0)
-				break;
+		nand.size = content->size;
+		ret = NANDStreamRun(&nand, 0, SnapshotContent, &snap);
+		NANDStreamClose(&nand);
+	}
+
+	if (ret < 0)
+		SnapshotAbort(&snap);
+	else
+		ret = SnapshotFinish(&snap);
+
+finish:
+	FreeTitle(&local);
+	return ret;
+}
+
+// Puts a title back the way SnapshotTitle found it, and throws the snapshot away if that worked.
+static int RestoreSnapshot(int64_t titleID) {
+	int ret;
+	char path[96];
+	Snapshot snap;
+	SnapshotHeader header;
+	struct Title title = { .id = titleID, .local = true, .mark = ArenaMark() };
+
+	SnapshotPath(titleID, path);
+
+	ret = NANDReadFileSimple("/sys/cert.sys", sizeof(RetailCerts), (unsigned char**)&title.certs, NULL);
+	if (ret < 0)
+		goto finish;
+
+	ret = SnapshotOpen(&snap, path);
+	if (ret < 0)
+		goto finish;
 
-			if (!__builtin_is_aligned(cdownload.ptr, 0x20)) {
-				buffer = memalign32(cdownload.size);
-				if (!buffer) {
-					ret = -ENOMEM;
-					break;
-				}
-
-				memcpy(buffer, cdownload.ptr, cdownload.size);
-				free(cdownload.ptr);
-			}
-			else {
-				buffer = cdownload.ptr;
-			}
-
-			ret = ES_AddContentData(cfd, buffer, cdownload.size);
-			free(buffer);
+	ret = SnapshotRead(&snap, &header, sizeof(header));
+	if (ret >= 0 && (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) || header.titleID != titleID
+	|| header.tik_size != STD_SIGNED_TIK_SIZE))
+		ret = -EINVAL;
+
+	if (ret >= 0) {
+		title.s_tmd = ArenaAlloc(header.tmd_size);
+		title.s_tik = ArenaAlloc(header.tik_size);
+		if (!title.s_tmd || !title.s_tik)
+			ret = -ENOMEM;
+	}
+
+	if (ret >= 0)
+		ret = SnapshotRead(&snap, title.s_tmd, header.tmd_size);
+	if (ret >= 0)
+		ret = SnapshotRead(&snap, title.s_tik, header.tik_size);
+
+	if (ret >= 0) {
+		title.tmd_size = header.tmd_size;
+		title.tmd      = SIGNATURE_PAYLOAD(title.s_tmd);
+		title.tik_size = header.tik_size;
+		title.ticket   = SIGNATURE_PAYLOAD(title.s_tik);
+		TitleCryptoInit(&title.crypto, title.ticket);
+
+		restoring = &snap;
+		ret = InstallTitle(&title, false);
+		restoring = NULL;
+	}
+
+	SnapshotClose(&snap);
+	if (ret >= 0)
+		remove(path);
+
+finish:
+	ArenaRelease(title.mark);
+	return ret;
+}
+
+int InstallTitle(struct Title* title, bool purge) {
+	int ret;
+	size_t mark = ArenaMark();
+	bool snapshot = false, restarted = false;
+	SharedContentLookup shared = { title->tmd };
+
+	if (planning) {
+		if (ES != &ESEmulated)
+			JournalPlanned(title->tmd->title_id);
+		return PlanTitle(title);
+	}
+
+	if (staging == STAGING_DOWNLOAD)
+		return StageTitle(title);
+
+	if (title->ticket->reserved[0xb] != 0) {
+		TitleCryptoWrap(&title->crypto, title->ticket, 0);
+		Fakesign(title);
+	}
+
+	MemProfSetPhase(MEMPHASE_ES);
+	if (purge) {
+		if (snapshot_dir[0]) {
+			LogPrintf("	>> Taking a snapshot first...\n");
+			ret = SnapshotTitle(title->tmd->title_id);
+			snapshot = (ret == 0);
+			// -106: there's nothing installed to take one of.
+			if (ret < 0 && ret != -106)
+				LogPrintf("	>> Couldn't (%i), if this goes wrong there's nothing to go back to.\n", ret);
 		}
 
-		ret = ES_AddContentFinish(cfd);
+		ret = PurgeTitle(title->tmd->title_id);
+		if (ret < 0)
+			goto finish;
+	}
+
+	MemProfSetPhase(MEMPHASE_METADATA);
+	ret = LookupSharedContents(&shared);
+	if (ret < 0)
+		goto finish;
+
+	MemProfSetPhase(MEMPHASE_ES);
+
+	// Everything in the arena is already 32-byte aligned, no need to copy these out.
+	LogPrintf("	>> Installing ticket...\n");
+	ret = ES->AddTicket(title->s_tik, title->tik_size, (signed_blob*)title->certs, sizeof(RetailCerts));
+	if (ret < 0)
+		goto finish;
+
+restart:
+	LogPrintf("	>> Installing TMD...\n");
+	ret = ES->AddTitleStart(title->s_tmd, title->tmd_size, (signed_blob*)title->certs, sizeof(RetailCerts));
+	if (ret < 0)
+		goto finish;
+
+	for (int i = 0; i < title->tmd->num_contents; i++) {
+		tmd_content* content = title->tmd->contents + i;
+
+		if (content->type & 0x8000) {
+			if (title->local) continue;
+
+			if (SharedContentFound(&shared, i)) continue;
+		}
+
+		LogPrintf("	>> Installing content #%u...\n", content->index);
+		int cfd = ret = ES->AddContentStart(title->tmd->title_id, content->cid);
+		if (ret < 0)
+			break;
+
+		if (title->local)
+			ret = restoring ? AddSnapshotContent(title, content, cfd) : AddLocalContent(title, content, cfd);
+		else if (staging != STAGING_INSTALL || (ret = AddStagedContent(title, content, cfd)) == -ENOENT)
+			ret = AddDownloadedContent(title, content, &cfd);
+
+		if (ret < 0)
+			break;
+
+		MemProfSetPhase(MEMPHASE_ES);
+		ret = ES->AddContentFinish(cfd);
 		if (ret < 0)
 			break;
 
 	}
 
 	if (!ret) {
-		puts("	>> Finishing installation...");
-		ret = ES_AddTitleFinish();
+		LogPrintf("	>> Finishing installation...\n");
+		ret = ES->AddTitleFinish();
+		// Putting the old version back isn't what the journal means by finished, and neither is pretending to.
+		if (!ret && !restoring && ES != &ESEmulated)
+			JournalFinished(title->tmd->title_id, title->tmd->title_version);
 	}
 
 	if (ret < 0)
-		ES_AddTitleCancel();
+		ES->AddTitleCancel();
+
+	// Only once, the second time round it's all from the real server.
+	if (ret == RESTART_TITLE && !restarted) {
+		LogPrintf("	>> Starting the title over...\n");
+		restarted = true;
+		goto restart;
+	}
 
 finish:
-	free(s_buffer);
+	peer_skipped = false;
+	if (snapshot) {
+		char path[96];
+
+		SnapshotPath(title->tmd->title_id, path);
+		if (ret >= 0) {
+			remove(path);
+		}
+		else {
+			LogPrintf("	>> Failed (%i), putting the old one back...\n", ret);
+			int retr = RestoreSnapshot(title->tmd->title_id);
+			if (retr < 0)
+				LogPrintf("	>> That didn't work either (%i). It's still in %s.\n", retr, path);
+		}
+	}
+
+	ArenaRelease(mark);
 	return ret;
 }
 
@@ -290,31 +1091,46 @@ static inline void zero_sig(signed_blob* blob) {
 	memset(SIGNATURE_SIG(blob), 0, SIGNATURE_SIZE(blob) - 4);
 }
 
-bool Fakesign(struct Title* title) {
-	sha1 hash;
-	zero_sig(title->s_tik);
-	zero_sig(title->s_tmd);
-
-	for (uint16_t i = 0; i < 0xFFFFu; i++) {
-		title->ticket->padding = i;
-		mbedtls_sha1_ret((const unsigned char*)title->ticket, sizeof(tik), hash);
-		if (!hash[0]) break;
+/*
+ * Brute-forces the 16 bits at `offset` until the SHA-1 of `data` starts with a zero byte, which is all IOS checks
+ * with the signature zeroed (the trucha bug). The answer only depends on the bytes, so it's kept in signcache.
+ */
+static bool FakesignField(unsigned char* data, size_t size, size_t offset) {
+	sha1 key, hash;
+	uint16_t value = 0;
+
+	memcpy(data + offset, &value, sizeof(value));
+	mbedtls_sha1_ret(data, size, key);
+
+	if (SignCacheLookup(key, &value)) {
+		memcpy(data + offset, &value, sizeof(value));
+		mbedtls_sha1_ret(data, size, hash);
+		if (!hash[0])
+			return true;
 	}
-	if (hash[0]) return false;
 
 	for (uint16_t i = 0; i < 0xFFFFu; i++) {
-		title->tmd->fill3 = i;
-		mbedtls_sha1_ret((const unsigned char*)title->tmd, TMD_SIZE(title->tmd), hash);
-		if (!hash[0]) break;
+		memcpy(data + offset, &i, sizeof(i));
+		mbedtls_sha1_ret(data, size, hash);
+		if (!hash[0]) {
+			SignCacheStore(key, i);
+			return true;
+		}
 	}
-	if (hash[0]) return false;
 
-	return true;
+	return false;
+}
+
+bool Fakesign(struct Title* title) {
+	zero_sig(title->s_tik);
+	zero_sig(title->s_tmd);
+
+	return FakesignField((unsigned char*)title->ticket, sizeof(tik), offsetof(tik, padding))
+		&& FakesignField((unsigned char*)title->tmd, TMD_SIZE(title->tmd), offsetof(tmd, fill3));
 }
 
 void FreeTitle(struct Title* title) {
-	if (!title) return;
-	free(title->certs);
-	free(title->s_tmd);
-	free(title->s_tik);
+	if (!title || (!title->certs && !title->view && !title->tmd)) return;
+	ArenaRelease(title->mark);
+	memset(title, 0, sizeof(struct Title));
 }
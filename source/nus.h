@@ -1,10 +1,21 @@
 #include <stdint.h>
 
 #include "es.h"
+#include "crypto.h"
+
+// How much of an installed title to load. Each one includes the ones before it.
+typedef enum {
+	TITLE_VIEW, // version and content list (ES_GetTMDView), in view
+	TITLE_TMD,  // the stored TMD
+	TITLE_FULL, // cert.sys, the ticket and the title key, enough to reinstall it
+} TitleTier;
 
 struct Title {
 	int64_t id;
 	bool local;
+	size_t mark;
+
+	tmd_view* view;
 
 	RetailCerts* certs;
 
@@ -16,11 +27,43 @@ struct Title {
 	size_t tik_size;
 	struct _tik* ticket;
 
-	aeskey key;
+	TitleCrypto crypto;
 };
 
+typedef enum {
+	STAGING_OFF,
+	STAGING_DOWNLOAD, // InstallTitle only downloads to the staging directory
+	STAGING_INSTALL,  // InstallTitle installs from it, downloading whatever isn't there
+} StagingMode;
+
+typedef struct {
+	uint32_t titles;
+	uint32_t contents;
+	uint64_t download; // bytes
+	uint64_t nand;     // bytes
+	uint32_t clusters;
+	uint32_t inodes;
+} InstallPlan;
+
+void SetNUSServer(const char* server);
+const char* GetNUSServer(void);
+void SetNUSPeer(const char* peer);
+const char* GetNUSPeer(void);
+void SetStaging(StagingMode mode, const char* dir);
+void SetSnapshotDir(const char* dir); // where a title goes before InstallTitle purges it, NULL for nowhere
+void PlanInstalls(InstallPlan* plan);
+
+// How many connections to split big contents over. 1 to turn that off.
+extern unsigned NUSDownloadSegments;
 int DownloadTitleMeta(int64_t, int, struct Title*);
-int GetInstalledTitle(int64_t, struct Title*);
+int GetInstalledTitle(int64_t, struct Title*); // TITLE_FULL
+int GetInstalledTitleTier(int64_t, TitleTier, struct Title*);
+/*
+ * Loads the rest of an installed title, up to that tier. This comes out of the arena like everything else,
+ * so anything loaded after the title and freed before it takes this with it.
+ */
+int LoadInstalledTitle(struct Title*, TitleTier);
+uint16_t TitleVersion(const struct Title*);
 void ChangeTitleID(struct Title*, int64_t);
 bool Fakesign(struct Title*);
 int InstallTitle(struct Title*, bool purge);
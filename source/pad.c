@@ -30,6 +30,7 @@ void scanpads() {
 	if (gcn_down & PAD_BUTTON_X) pad_buttons |= WPAD_BUTTON_1;
 	if (gcn_down & PAD_BUTTON_Y) pad_buttons |= WPAD_BUTTON_2;
 	if (gcn_down & PAD_BUTTON_START) pad_buttons |= WPAD_BUTTON_HOME | WPAD_BUTTON_PLUS;
+	if (gcn_down & PAD_TRIGGER_Z) pad_buttons |= WPAD_BUTTON_MINUS;
 	if (gcn_down & PAD_BUTTON_UP) pad_buttons |= WPAD_BUTTON_UP;
 	if (gcn_down & PAD_BUTTON_DOWN) pad_buttons |= WPAD_BUTTON_DOWN;
 	if (gcn_down & PAD_BUTTON_LEFT) pad_buttons |= WPAD_BUTTON_LEFT;
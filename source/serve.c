@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "serve.h"
+
+#ifdef GEKKO
+#include <ogc/lwp.h>
+typedef lwp_t Thread;
+
+static int StartThread(Thread* thread, void* (*entry)(void*), void* arg) {
+	return LWP_CreateThread(thread, entry, arg, NULL, 0x4000, 50);
+}
+
+static void JoinThread(Thread thread) {
+	LWP_JoinThread(thread, NULL);
+}
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+
+static int StartThread(Thread* thread, void* (*entry)(void*), void* arg) {
+	return -pthread_create(thread, NULL, entry, arg);
+}
+
+static void JoinThread(Thread thread) {
+	pthread_join(thread, NULL);
+}
+#endif
+
+#define SERVE_BUFFER_SIZE  0x10000
+#define SERVE_IDLE_SECONDS 10
+#define DISCOVERY_QUERY    "SCR-SERVE?"
+#define DISCOVERY_REPLY    "SCR-SERVE"
+
+typedef struct {
+	Thread thread;
+	int sock;
+	volatile bool busy;
+	bool started;
+} Client;
+
+static char serve_dir[64];
+static unsigned short serve_port;
+static volatile bool serving = false;
+static int listen_sock = -1, discovery_sock = -1;
+static Thread accept_thread, discovery_thread;
+static Client clients[SERVE_MAX_CLIENTS];
+static volatile unsigned requests = 0;
+
+static int WaitReadable(int sock, int ms) {
+	fd_set fds;
+	struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+
+	FD_ZERO(&fds);
+	FD_SET(sock, &fds);
+	return select(sock + 1, &fds, NULL, NULL, &tv);
+}
+
+static bool SendAll(int sock, const void* data, size_t length) {
+	const char* ptr = data;
+
+	while (length) {
+		ssize_t sent = send(sock, ptr, length, 0);
+		if (sent <= 0)
+			return false;
+
+		ptr += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+// Returns whether the connection can be used again.
+static bool SendStatus(int sock, int status, const char* reason, bool keepalive) {
+	char header[128];
+	int len = sprintf(header, "HTTP/1.1 %i %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+					  status, reason, keepalive ? "keep-alive" : "close");
+
+	return SendAll(sock, header, len) && keepalive;
+}
+
+// 16 hex digits for the title, then tmd, tmd.<rev>, cetk or 8 hex digits for a content. Nothing else gets out.
+static bool ParsePath(const char* path, char* out) {
+	char tid[17], name[16];
+	int len = 0;
+
+	if (sscanf(path, "/ccs/download/%16[0-9a-fA-F]/%15[0-9a-zA-Z.]%n", tid, name, &len) != 2 || path[len] || strlen(tid) != 16)
+		return false;
+
+	for (char* c = tid; *c; c++) *c = tolower((unsigned char)*c);
+	for (char* c = name; *c; c++) *c = tolower((unsigned char)*c);
+
+	if (strcmp(name, "tmd") && strcmp(name, "cetk")
+	&& !(!strncmp(name, "tmd.", 4) && name[4] && strspn(name + 4, "0123456789") == strlen(name + 4))
+	&& !(strlen(name) == 8 && strspn(name, "0123456789abcdef") == 8))
+		return false;
+
+	sprintf(out, "%s/%s/%s", serve_dir, tid, name);
+	return true;
+}
+
+// Returns false if the connection should be closed.
+static bool HandleRequest(int sock, char* request, char* buffer) {
+	char method[8], path[96], proto[10];
+	char file[160];
+	long long start = 0, end = -1;
+	bool keepalive = true, ranged = false;
+	struct stat st;
+
+	if (sscanf(request, "%7s %95s %9s", method, path, proto) != 3)
+		return SendStatus(sock, 400, "Bad Request", false);
+
+	if (!strcmp(proto, "HTTP/1.0"))
+		keepalive = false;
+
+	for (char* line = strstr(request, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n")) {
+		char* header = line + 2;
+
+		if (!strncasecmp(header, "Connection:", 11))
+			keepalive = !strncasecmp(header + 11 + strspn(header + 11, " "), "keep-alive", 10);
+
+		else if (!strncasecmp(header, "Range:", 6)) {
+			// Only the one kind NUSDownload asks for. (a- and a-b)
+			if (sscanf(header + 6, " bytes=%lld-%lld", &start, &end) < 1)
+				return SendStatus(sock, 416, "Range Not Satisfiable", keepalive);
+
+			ranged = true;
+		}
+	}
+
+	requests++;
+
+	if (strcmp(method, "GET") && strcmp(method, "HEAD"))
+		return SendStatus(sock, 405, "Method Not Allowed", keepalive);
+
+	if (!ParsePath(path, file) || stat(file, &st) < 0 || !S_ISREG(st.st_mode))
+		return SendStatus(sock, 404, "Not Found", keepalive);
+
+	if (end < 0 || end >= st.st_size)
+		end = st.st_size - 1;
+
+	if (ranged && (start > end || start >= st.st_size))
+		return SendStatus(sock, 416, "Range Not Satisfiable", keepalive);
+
+	FILE* fp = fopen(file, "rb");
+	if (!fp || fseeko(fp, start, SEEK_SET) < 0) {
+		if (fp) fclose(fp);
+		return SendStatus(sock, 500, "Internal Server Error", false);
+	}
+
+	long long length = end - start + 1;
+	int len = sprintf(buffer, "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\n",
+					  ranged ? "206 Partial Content" : "200 OK", length);
+	if (ranged)
+		len += sprintf(buffer + len, "Content-Range: bytes %lld-%lld/%lld\r\n", start, end, (long long)st.st_size);
+
+	len += sprintf(buffer + len, "Connection: %s\r\n\r\n", keepalive ? "keep-alive" : "close");
+
+	bool ok = SendAll(sock, buffer, len);
+	while (ok && length && strcmp(method, "HEAD")) {
+		size_t chunk = length < SERVE_BUFFER_SIZE ? length : SERVE_BUFFER_SIZE;
+
+		if (fread(buffer, 1, chunk, fp) != chunk) {
+			ok = false;
+			break;
+		}
+
+		ok = SendAll(sock, buffer, chunk);
+		length -= chunk;
+	}
+
+	fclose(fp);
+	return ok && keepalive;
+}
+
+static void* ClientThread(void* arg) {
+	Client* client = arg;
+	char request[1024] = "";
+	size_t filled = 0;
+	char* buffer = malloc(SERVE_BUFFER_SIZE);
+
+	while (buffer && serving) {
+		char* end;
+
+		while (!(end = strstr(request, "\r\n\r\n"))) {
+			if (filled == sizeof(request) - 1 || WaitReadable(client->sock, SERVE_IDLE_SECONDS * 1000) <= 0)
+				goto finish;
+
+			ssize_t got = recv(client->sock, request + filled, sizeof(request) - 1 - filled, 0);
+			if (got <= 0)
+				goto finish;
+
+			filled += got;
+			request[filled] = 0;
+		}
+
+		end[2] = 0;
+		if (!HandleRequest(client->sock, request, buffer))
+			break;
+
+		// Anything pipelined after it
+		size_t used = end + 4 - request;
+		memmove(request, request + used, filled - used + 1);
+		filled -= used;
+	}
+
+finish:
+	free(buffer);
+	close(client->sock);
+	client->busy = false;
+	return NULL;
+}
+
+static void* AcceptThread(void* arg) {
+	while (serving) {
+		Client* client = NULL;
+		for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+			if (!clients[i].busy) {
+				client = clients + i;
+				break;
+			}
+		}
+
+		// Everyone's busy. Leave them in the backlog until someone finishes.
+		if (!client) {
+			usleep(50000);
+			continue;
+		}
+
+		if (WaitReadable(listen_sock, 500) <= 0)
+			continue;
+
+		int sock = accept(listen_sock, NULL, NULL);
+		if (sock < 0)
+			continue;
+
+		if (client->started)
+			JoinThread(client->thread);
+
+		client->sock = sock;
+		client->busy = true;
+		client->started = StartThread(&client->thread, ClientThread, client) >= 0;
+		if (!client->started) {
+			close(sock);
+			client->busy = false;
+		}
+	}
+
+	return NULL;
+}
+
+static void* DiscoveryThread(void* arg) {
+	char packet[32];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+
+	while (serving) {
+		if (WaitReadable(discovery_sock, 500) <= 0)
+			continue;
+
+		fromlen = sizeof(from);
+		ssize_t got = recvfrom(discovery_sock, packet, sizeof(packet) - 1, 0, (struct sockaddr*)&from, &fromlen);
+		if (got <= 0)
+			continue;
+
+		packet[got] = 0;
+		if (strcmp(packet, DISCOVERY_QUERY))
+			continue;
+
+		int len = sprintf(packet, DISCOVERY_REPLY " %hu", serve_port);
+		sendto(discovery_sock, packet, len, 0, (struct sockaddr*)&from, fromlen);
+	}
+
+	return NULL;
+}
+
+static int OpenSocket(int type, unsigned short port) {
+	int one = 1;
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+
+	int sock = socket(AF_INET, type, 0);
+	if (sock < 0)
+		return -errno;
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || (type == SOCK_STREAM && listen(sock, SERVE_MAX_CLIENTS * 2) < 0)) {
+		int ret = -errno;
+		close(sock);
+		return ret;
+	}
+
+	return sock;
+}
+
+int ServeStart(const char* dir, unsigned short port) {
+	int ret;
+
+	if (serving)
+		return -EBUSY;
+
+	strncpy(serve_dir, dir, sizeof(serve_dir) - 1);
+	serve_port = port;
+	requests = 0;
+	memset(clients, 0, sizeof(clients));
+
+	listen_sock = OpenSocket(SOCK_STREAM, port);
+	if (listen_sock < 0)
+		return listen_sock;
+
+	// Not being discoverable isn't the end of the world.
+	discovery_sock = OpenSocket(SOCK_DGRAM, SERVE_DISCOVERY_PORT);
+
+	serving = true;
+	ret = StartThread(&accept_thread, AcceptThread, NULL);
+	if (ret < 0) {
+		serving = false;
+		close(listen_sock);
+		if (discovery_sock >= 0)
+			close(discovery_sock);
+
+		return ret;
+	}
+
+	if (discovery_sock >= 0 && StartThread(&discovery_thread, DiscoveryThread, NULL) < 0) {
+		close(discovery_sock);
+		discovery_sock = -1;
+	}
+
+	return 0;
+}
+
+void ServeStop(void) {
+	if (!serving)
+		return;
+
+	serving = false;
+	JoinThread(accept_thread);
+	if (discovery_sock >= 0) {
+		JoinThread(discovery_thread);
+		close(discovery_sock);
+		discovery_sock = -1;
+	}
+
+	// Whoever's still downloading notices on their next request, or SERVE_IDLE_SECONDS from now.
+	for (int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+		if (clients[i].started)
+			JoinThread(clients[i].thread);
+	}
+
+	close(listen_sock);
+	listen_sock = -1;
+}
+
+unsigned ServeRequests(void) {
+	return requests;
+}
+
+int DiscoverPeer(char* url, size_t size, int timeout_ms) {
+	int ret = -ENOENT, one = 1;
+	char packet[32];
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(SERVE_DISCOVERY_PORT), .sin_addr.s_addr = htonl(INADDR_BROADCAST) };
+	socklen_t addrlen = sizeof(addr);
+	unsigned short port;
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return -errno;
+
+	setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+	if (sendto(sock, DISCOVERY_QUERY, strlen(DISCOVERY_QUERY), 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		ret = -errno;
+		goto finish;
+	}
+
+	while (WaitReadable(sock, timeout_ms) > 0) {
+		ssize_t got = recvfrom(sock, packet, sizeof(packet) - 1, 0, (struct sockaddr*)&addr, &addrlen);
+		if (got <= 0)
+			break;
+
+		packet[got] = 0;
+		if (sscanf(packet, DISCOVERY_REPLY " %hu", &port) == 1) {
+			snprintf(url, size, "http://%s:%hu", inet_ntoa(addr.sin_addr), port);
+			ret = 0;
+			break;
+		}
+	}
+
+finish:
+	close(sock);
+	return ret;
+}
+
+#ifdef SERVE_STANDALONE
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <cache directory> [port]\n", argv[0]);
+		return 1;
+	}
+
+	int port = argc > 2 ? atoi(argv[2]) : SERVE_PORT;
+	int ret = ServeStart(argv[1], port);
+	if (ret < 0) {
+		fprintf(stderr, "ServeStart failed: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	printf("Serving %s on port %i. Enter to stop.\n", argv[1], port);
+	getchar();
+	ServeStop();
+	printf("%u requests.\n", ServeRequests());
+	return 0;
+}
+#endif
@@ -0,0 +1,20 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SERVE_PORT           8080
+#define SERVE_DISCOVERY_PORT 8081
+#define SERVE_MAX_CLIENTS    8 // two consoles pulling over NUSDownloadSegments connections each
+
+/*
+ * Serves a staging directory (see SetStaging) over HTTP, in the NUS layout, so the other
+ * consoles on the LAN can pull from it instead of the CDN. Anyone who broadcasts to
+ * SERVE_DISCOVERY_PORT gets told where it is.
+ *
+ * No libogc in here: `cc -DSERVE_STANDALONE -o restorer-serve source/serve.c -lpthread` runs it on a PC.
+ */
+int  ServeStart(const char* dir, unsigned short port);
+void ServeStop(void);
+unsigned ServeRequests(void);
+
+// Broadcasts for a console (or PC) that's serving. Fills in its base URL.
+int  DiscoverPeer(char* url, size_t size, int timeout_ms);
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "signcache.h"
+
+#define SIGNCACHE_MAX_ENTRIES 256
+
+typedef struct {
+	unsigned char key[20];
+	uint16_t value;
+} SignCacheEntry;
+
+static char cache_path[64];
+static SignCacheEntry entries[SIGNCACHE_MAX_ENTRIES];
+static int num_entries = 0;
+
+static SignCacheEntry* Find(const unsigned char key[20]) {
+	for (SignCacheEntry* entry = entries; entry < entries + num_entries; entry++) {
+		if (!memcmp(entry->key, key, sizeof(entry->key)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+int SignCacheOpen(const char* path) {
+	char line[64], hex[41];
+	unsigned value;
+	SignCacheEntry entry;
+
+	num_entries = 0;
+	strncpy(cache_path, path, sizeof(cache_path) - 1);
+
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return (errno == ENOENT) ? 0 : -errno;
+
+	while (fgets(line, sizeof(line), fp) && num_entries < SIGNCACHE_MAX_ENTRIES) {
+		if (sscanf(line, "%40[0-9a-f] %4x", hex, &value) != 2 || strlen(hex) != 40)
+			continue;
+
+		for (int i = 0; i < 20; i++)
+			sscanf(hex + (i * 2), "%2hhx", &entry.key[i]);
+		entry.value = value;
+
+		// A later line is a newer answer.
+		SignCacheEntry* found = Find(entry.key);
+		if (found)
+			found->value = entry.value;
+		else
+			entries[num_entries++] = entry;
+	}
+
+	fclose(fp);
+	return num_entries;
+}
+
+bool SignCacheLookup(const unsigned char key[20], uint16_t* value) {
+	SignCacheEntry* entry = Find(key);
+	if (!entry)
+		return false;
+
+	*value = entry->value;
+	return true;
+}
+
+// Straight onto the card, a half-written line just doesn't parse next time.
+void SignCacheStore(const unsigned char key[20], uint16_t value) {
+	SignCacheEntry* entry = Find(key);
+	if (entry) {
+		entry->value = value;
+	}
+	else if (num_entries < SIGNCACHE_MAX_ENTRIES) {
+		entry = entries + num_entries++;
+		memcpy(entry->key, key, sizeof(entry->key));
+		entry->value = value;
+	}
+
+	if (!cache_path[0])
+		return;
+
+	FILE* fp = fopen(cache_path, "a");
+	if (!fp)
+		return;
+
+	for (int i = 0; i < 20; i++)
+		fprintf(fp, "%02x", key[i]);
+	fprintf(fp, " %04x\n", value);
+	fclose(fp);
+}
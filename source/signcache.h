@@ -0,0 +1,15 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIGNCACHE_PATH "sd:/restorer-fakesign.txt"
+
+/*
+ * What Fakesign found last time, on the SD card. The key is the SHA-1 of the ticket or TMD with the
+ * signature and the brute-forced field (padding, fill3) zeroed, the value is what that field ended up as.
+ * The same clone comes out the same on every console, so it only has to be searched for once per fleet.
+ *
+ *   <SHA-1> <value, hex>
+ */
+int  SignCacheOpen(const char* path);
+bool SignCacheLookup(const unsigned char key[20], uint16_t* value);
+void SignCacheStore(const unsigned char key[20], uint16_t value);
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "arena.h"
+
+#define SNAPSHOT_BUFFER_SIZE 0x4000
+#define SNAPSHOT_WINDOW_BITS 12 // 4 KB
+#define SNAPSHOT_MEM_LEVEL   5
+
+// Gone all at once with ArenaRelease.
+static voidpf ZAlloc(voidpf opaque, uInt items, uInt size) {
+	return ArenaAlloc((size_t)items * size);
+}
+
+static void ZFree(voidpf opaque, voidpf ptr) {}
+
+static int Setup(Snapshot* snap, const char* path, bool writing) {
+	memset(snap, 0, sizeof(Snapshot));
+	snap->mark     = ArenaMark();
+	snap->z.zalloc = ZAlloc;
+	snap->z.zfree  = ZFree;
+
+	snap->buffer = ArenaAlloc(SNAPSHOT_BUFFER_SIZE);
+	if (!snap->buffer)
+		return -ENOMEM;
+
+	strncpy(snap->path, path, sizeof(snap->path) - 1);
+	snap->fp = fopen(path, writing ? "wb" : "rb");
+	if (!snap->fp) {
+		ArenaRelease(snap->mark);
+		return -errno;
+	}
+
+	return 0;
+}
+
+int SnapshotCreate(Snapshot* snap, const char* path) {
+	int ret = Setup(snap, path, true);
+	if (ret < 0)
+		return ret;
+
+	if (deflateInit2(&snap->z, Z_BEST_SPEED, Z_DEFLATED, SNAPSHOT_WINDOW_BITS, SNAPSHOT_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		fclose(snap->fp);
+		remove(path);
+		ArenaRelease(snap->mark);
+		return -ENOMEM;
+	}
+
+	snap->z.next_out  = snap->buffer;
+	snap->z.avail_out = SNAPSHOT_BUFFER_SIZE;
+	return 0;
+}
+
+static int Deflate(Snapshot* snap, int flush) {
+	int ret;
+
+	do {
+		ret = deflate(&snap->z, flush);
+		if (ret == Z_STREAM_ERROR)
+			return -EIO;
+
+		if (!snap->z.avail_out || (flush == Z_FINISH && snap->z.avail_out != SNAPSHOT_BUFFER_SIZE)) {
+			size_t length = SNAPSHOT_BUFFER_SIZE - snap->z.avail_out;
+			if (fwrite(snap->buffer, 1, length, snap->fp) != length)
+				return -EIO;
+
+			snap->z.next_out  = snap->buffer;
+			snap->z.avail_out = SNAPSHOT_BUFFER_SIZE;
+		}
+	} while (snap->z.avail_in || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+	return 0;
+}
+
+int SnapshotWrite(Snapshot* snap, const void* data, size_t length) {
+	snap->z.next_in  = (Bytef*)data;
+	snap->z.avail_in = length;
+
+	return Deflate(snap, Z_NO_FLUSH);
+}
+
+int SnapshotFinish(Snapshot* snap) {
+	int ret = Deflate(snap, Z_FINISH);
+
+	deflateEnd(&snap->z);
+	if (!ret && (fflush(snap->fp) || fsync(fileno(snap->fp)) < 0))
+		ret = -errno;
+
+	if (fclose(snap->fp) && !ret)
+		ret = -errno;
+
+	// Half a snapshot is worse than none, it'd get "restored".
+	if (ret < 0)
+		remove(snap->path);
+
+	ArenaRelease(snap->mark);
+	return ret;
+}
+
+void SnapshotAbort(Snapshot* snap) {
+	deflateEnd(&snap->z);
+	fclose(snap->fp);
+	remove(snap->path);
+	ArenaRelease(snap->mark);
+}
+
+int SnapshotOpen(Snapshot* snap, const char* path) {
+	int ret = Setup(snap, path, false);
+	if (ret < 0)
+		return ret;
+
+	if (inflateInit2(&snap->z, SNAPSHOT_WINDOW_BITS) != Z_OK) {
+		fclose(snap->fp);
+		ArenaRelease(snap->mark);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int SnapshotRead(Snapshot* snap, void* data, size_t length) {
+	snap->z.next_out  = data;
+	snap->z.avail_out = length;
+
+	while (snap->z.avail_out) {
+		if (!snap->z.avail_in) {
+			snap->z.next_in  = snap->buffer;
+			snap->z.avail_in = fread(snap->buffer, 1, SNAPSHOT_BUFFER_SIZE, snap->fp);
+			if (!snap->z.avail_in)
+				return -EIO;
+		}
+
+		int ret = inflate(&snap->z, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END && snap->z.avail_out)
+			return -EIO;
+		else if (ret != Z_OK && ret != Z_STREAM_END)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+void SnapshotClose(Snapshot* snap) {
+	inflateEnd(&snap->z);
+	fclose(snap->fp);
+	ArenaRelease(snap->mark);
+}
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#define SNAPSHOT_DIR   "sd:/restorer-snapshots"
+#define SNAPSHOT_MAGIC "SCRSNAP1"
+
+/*
+ * What a title looked like before InstallTitle purged it, so a failed reinstall can put it back.
+ * One zlib stream per file, with everything in it back to back:
+ *
+ *   SnapshotHeader, the signed TMD, the signed ticket, then every content that isn't shared, in TMD order,
+ *   decrypted, exactly as it was on the NAND (shared contents stay where they are through a purge).
+ *
+ * Compression is tuned for speed over size and a small window, zlib's state comes out of the arena
+ * (a few dozen KB), and the contents go through in I/O-buffer-sized pieces.
+ */
+typedef struct {
+	char magic[8];
+	int64_t titleID;
+	uint32_t tmd_size;
+	uint32_t tik_size;
+	uint32_t num_contents; // the ones in the snapshot
+} SnapshotHeader;
+
+typedef struct {
+	FILE* fp;
+	z_stream z;
+	unsigned char* buffer;
+	size_t mark;
+	char path[96];
+} Snapshot;
+
+int  SnapshotCreate(Snapshot*, const char* path);
+int  SnapshotWrite(Snapshot*, const void* data, size_t length);
+int  SnapshotFinish(Snapshot*); // everything's on the card, or the file is gone
+void SnapshotAbort(Snapshot*);
+
+int  SnapshotOpen(Snapshot*, const char* path);
+int  SnapshotRead(Snapshot*, void* data, size_t length); // all of it, or -EIO
+void SnapshotClose(Snapshot*);
@@ -0,0 +1,253 @@
+#ifdef IPCTRACE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <ogc/irq.h>
+#include <ogc/lwp_watchdog.h>
+
+#include "trace.h"
+#include "log.h"
+
+#define TRACE_RING_SIZE  1024
+#define TRACE_MAX_CALLS  32
+
+typedef struct {
+	const char* call;
+	uint64_t arg;
+	uint32_t when; // ms since the first call
+	char detail[28];
+	uint32_t bytes;
+	uint32_t usecs;
+	int ret;
+} TraceEntry;
+
+// Latency buckets, in microseconds. The last one catches everything slower.
+static const uint32_t BucketLimits[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, UINT32_MAX };
+#define TRACE_BUCKETS (sizeof(BucketLimits) / sizeof(BucketLimits[0]))
+
+typedef struct {
+	const char* call;
+	uint32_t count;
+	uint32_t errors;
+	uint64_t bytes;
+	uint64_t usecs;
+	uint32_t max;
+	uint32_t buckets[TRACE_BUCKETS];
+} TraceStats;
+
+static TraceEntry ring[TRACE_RING_SIZE];
+static uint32_t ring_next = 0;
+static TraceStats stats[TRACE_MAX_CALLS];
+static unsigned stats_count = 0;
+static uint64_t epoch = 0;
+
+#ifdef RECORD
+static FILE* recording = NULL;
+static uint32_t recorded = 0; // ring index of the next entry to write out
+#endif
+
+static TraceStats* GetStats(const char* call) {
+	for (TraceStats* s = stats; s < stats + stats_count; s++) {
+		if (s->call == call || !strcmp(s->call, call))
+			return s;
+	}
+
+	if (stats_count == TRACE_MAX_CALLS)
+		return NULL;
+
+	stats[stats_count].call = call;
+	return stats + stats_count++;
+}
+
+// Also called from the ISFS async callback, hence the interrupts being off.
+void TraceRecord(const char* call, uint64_t arg, const char* detail, uint32_t bytes, uint64_t start, int ret) {
+	uint32_t usecs = diff_usec(start, gettime());
+	uint32_t level;
+
+	_CPU_ISR_Disable(level);
+
+	if (!epoch)
+		epoch = start;
+
+	TraceEntry* entry = ring + (ring_next++ % TRACE_RING_SIZE);
+	entry->call  = call;
+	entry->when  = diff_msec(epoch, start);
+	entry->arg   = arg;
+	entry->bytes = bytes;
+	entry->usecs = usecs;
+	entry->ret   = ret;
+	entry->detail[0] = 0;
+	if (detail) {
+		// Keep the end of the path, that's the interesting part
+		size_t len = strlen(detail);
+		if (len >= sizeof(entry->detail))
+			detail += len - (sizeof(entry->detail) - 1);
+
+		strcpy(entry->detail, detail);
+	}
+
+	TraceStats* s = GetStats(call);
+	if (s) {
+		s->count++;
+		s->bytes += bytes;
+		s->usecs += usecs;
+		if (ret < 0)
+			s->errors++;
+		if (usecs > s->max)
+			s->max = usecs;
+
+		unsigned i = 0;
+		while (usecs >= BucketLimits[i])
+			i++;
+
+		s->buckets[i]++;
+	}
+
+	_CPU_ISR_Restore(level);
+}
+
+// To fp, or to wherever LogPrintf goes without one.
+[[gnu::format(printf, 2, 3)]]
+static void StatsPrintf(FILE* fp, const char* fmt, ...) {
+	char text[160];
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (fp) {
+		vfprintf(fp, fmt, ap);
+	} else {
+		vsnprintf(text, sizeof(text), fmt, ap);
+		LogPrintf("%s", text);
+	}
+	va_end(ap);
+}
+
+static void PrintStats(FILE* fp) {
+	uint64_t total_usecs = 0;
+
+	for (TraceStats* s = stats; s < stats + stats_count; s++)
+		total_usecs += s->usecs;
+
+	StatsPrintf(fp, "%-26s %7s %5s %10s %10s %8s %8s %6s\n", "call", "count", "errs", "KB", "total ms", "avg us", "max us", "time%");
+	for (TraceStats* s = stats; s < stats + stats_count; s++) {
+		StatsPrintf(fp, "%-26s %7u %5u %10llu %10llu %8llu %8u %5.1f%%\n",
+				s->call, s->count, s->errors, s->bytes >> 10, s->usecs / 1000, s->usecs / s->count, s->max,
+				total_usecs ? (s->usecs * 100.0) / total_usecs : 0.0);
+	}
+
+	StatsPrintf(fp, "\nLatency histograms (us):\n%-26s", "call");
+	for (unsigned i = 0; i < TRACE_BUCKETS - 1; i++)
+		StatsPrintf(fp, " <%-6u", BucketLimits[i]);
+	StatsPrintf(fp, " >=%-6u\n", BucketLimits[TRACE_BUCKETS - 2]);
+
+	for (TraceStats* s = stats; s < stats + stats_count; s++) {
+		StatsPrintf(fp, "%-26s", s->call);
+		for (unsigned i = 0; i < TRACE_BUCKETS; i++)
+			StatsPrintf(fp, " %7u", s->buckets[i]);
+
+		StatsPrintf(fp, "\n");
+	}
+
+	StatsPrintf(fp, "\nTotal time inside IOS: %llu ms\n", total_usecs / 1000);
+}
+
+void TracePrint(void) {
+	if (!stats_count)
+		return;
+
+	LogPrintf("\nIPC trace:\n");
+	PrintStats(NULL);
+}
+
+int TraceDump(const char* path) {
+	if (!stats_count)
+		return 0;
+
+	FILE* fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	PrintStats(fp);
+
+	uint32_t first = (ring_next > TRACE_RING_SIZE) ? ring_next - TRACE_RING_SIZE : 0;
+	fprintf(fp, "\nLast %u calls:\ncall,arg,detail,bytes,us,ret\n", ring_next - first);
+	for (uint32_t i = first; i < ring_next; i++) {
+		TraceEntry* entry = ring + (i % TRACE_RING_SIZE);
+		fprintf(fp, "%s,%016llx,%s,%u,%u,%i\n", entry->call, entry->arg, entry->detail, entry->bytes, entry->usecs, entry->ret);
+	}
+
+	fclose(fp);
+	LogPrintf("\t>> IPC trace saved to %s\n", path);
+	return 0;
+}
+
+#ifdef RECORD
+int TraceStartRecording(const char* path) {
+	if (recording)
+		return -EBUSY;
+
+	recording = fopen(path, "w");
+	if (!recording)
+		return -errno;
+
+	if (!epoch)
+		epoch = gettime();
+
+	recorded = ring_next;
+	fputs("# system channel restorer session trace v1\n", recording);
+	LogPrintf("\t>> Recording this session to %s\n", path);
+	return 0;
+}
+
+// Called between downloads and titles, never from the IOS callback.
+void TraceFlush(void) {
+	uint32_t level, next;
+
+	if (!recording)
+		return;
+
+	_CPU_ISR_Disable(level);
+	next = ring_next;
+	_CPU_ISR_Restore(level);
+
+	if (next - recorded > TRACE_RING_SIZE) {
+		fprintf(recording, "# dropped %u calls\n", next - recorded - TRACE_RING_SIZE);
+		recorded = next - TRACE_RING_SIZE;
+	}
+
+	for (; recorded < next; recorded++) {
+		TraceEntry* entry = ring + (recorded % TRACE_RING_SIZE);
+		fprintf(recording, "I %u %u %s %llx %u %i %s\n", entry->when, entry->usecs, entry->call, entry->arg,
+				entry->bytes, entry->ret, entry->detail[0] ? entry->detail : "-");
+	}
+}
+
+void TraceHTTP(const char* url, long status, int result, uint64_t offset, uint64_t bytes, uint64_t start, const unsigned char* hash) {
+	char hexhash[41] = "-";
+
+	if (!recording)
+		return;
+
+	// Anything ES/ISFS did before this request goes first, so the order is preserved.
+	TraceFlush();
+
+	if (hash) {
+		for (int i = 0; i < 20; i++)
+			sprintf(hexhash + (i * 2), "%02x", hash[i]);
+	}
+
+	fprintf(recording, "H %u %u %li %i %llu %llu %s %s\n", diff_msec(epoch, start), diff_msec(start, gettime()),
+			status, result, offset, bytes, hexhash, url);
+}
+
+void TraceStopRecording(void) {
+	if (!recording)
+		return;
+
+	TraceFlush();
+	fclose(recording);
+	recording = NULL;
+}
+#endif
+#endif
@@ -0,0 +1,84 @@
+#include <stdint.h>
+
+/*
+ * Build with `make IPCTRACE=1` to time every ES and ISFS call the restorer makes.
+ * The calls go into a ring buffer and per-call statistics, which are printed (and dumped to SD, if it's mounted) at exit.
+ *
+ * This header replaces the libogc functions with traced versions, so include it *after* the libogc headers.
+ */
+#ifdef IPCTRACE
+#include <ogc/lwp_watchdog.h>
+
+void TraceRecord(const char* call, uint64_t arg, const char* detail, uint32_t bytes, uint64_t start, int ret);
+void TracePrint(void);
+int  TraceDump(const char* path);
+
+#define TRACED(call, arg, detail, bytes, expr) ({					\
+	uint64_t __trace_start = gettime();								\
+	int __trace_ret = (expr);										\
+	TraceRecord(call, arg, detail, bytes, __trace_start, __trace_ret);	\
+	__trace_ret;													\
+})
+
+#define ES_AddTicket(tik, tik_size, certs, certs_size, crl, crl_size) \
+	TRACED("ES_AddTicket", 0, NULL, tik_size, ES_AddTicket(tik, tik_size, certs, certs_size, crl, crl_size))
+#define ES_AddTitleStart(tmd, tmd_size, certs, certs_size, crl, crl_size) \
+	TRACED("ES_AddTitleStart", 0, NULL, tmd_size, ES_AddTitleStart(tmd, tmd_size, certs, certs_size, crl, crl_size))
+#define ES_AddContentStart(tid, cid)	TRACED("ES_AddContentStart", tid, NULL, 0, ES_AddContentStart(tid, cid))
+#define ES_AddContentData(cfd, data, size) \
+	TRACED("ES_AddContentData", cfd, NULL, size, ES_AddContentData(cfd, data, size))
+#define ES_AddContentFinish(cfd)		TRACED("ES_AddContentFinish", cfd, NULL, 0, ES_AddContentFinish(cfd))
+#define ES_AddTitleFinish()				TRACED("ES_AddTitleFinish", 0, NULL, 0, ES_AddTitleFinish())
+#define ES_AddTitleCancel()				TRACED("ES_AddTitleCancel", 0, NULL, 0, ES_AddTitleCancel())
+#define ES_DeleteTitle(tid)				TRACED("ES_DeleteTitle", tid, NULL, 0, ES_DeleteTitle(tid))
+#define ES_DeleteTitleContent(tid)		TRACED("ES_DeleteTitleContent", tid, NULL, 0, ES_DeleteTitleContent(tid))
+#define ES_DeleteTicket(view)			TRACED("ES_DeleteTicket", (view)->ticketid, NULL, 0, ES_DeleteTicket(view))
+#define ES_GetStoredTMDSize(tid, size)	TRACED("ES_GetStoredTMDSize", tid, NULL, 0, ES_GetStoredTMDSize(tid, size))
+#define ES_GetStoredTMD(tid, tmd, size)	TRACED("ES_GetStoredTMD", tid, NULL, size, ES_GetStoredTMD(tid, tmd, size))
+#define ES_GetTitleContentsCount(tid, count) \
+	TRACED("ES_GetTitleContentsCount", tid, NULL, 0, ES_GetTitleContentsCount(tid, count))
+#define ES_GetNumTicketViews(tid, count) \
+	TRACED("ES_GetNumTicketViews", tid, NULL, 0, ES_GetNumTicketViews(tid, count))
+#define ES_GetTicketViews(tid, views, count) \
+	TRACED("ES_GetTicketViews", tid, NULL, (count) * sizeof(tikview), ES_GetTicketViews(tid, views, count))
+#define ES_GetTMDViewSize(tid, size)	TRACED("ES_GetTMDViewSize", tid, NULL, 0, ES_GetTMDViewSize(tid, size))
+#define ES_GetTMDView(tid, view, size)	TRACED("ES_GetTMDView", tid, NULL, size, ES_GetTMDView(tid, view, size))
+#define ES_GetNumTitles(count)			TRACED("ES_GetNumTitles", 0, NULL, 0, ES_GetNumTitles(count))
+#define ES_GetTitles(titles, count)		TRACED("ES_GetTitles", 0, NULL, (count) * sizeof(u64), ES_GetTitles(titles, count))
+#define ES_GetDeviceID(id)				TRACED("ES_GetDeviceID", 0, NULL, 0, ES_GetDeviceID(id))
+
+#define ISFS_Open(path, mode)			TRACED("ISFS_Open", mode, path, 0, ISFS_Open(path, mode))
+#define ISFS_GetFileStats(fd, stats)	TRACED("ISFS_GetFileStats", fd, NULL, 0, ISFS_GetFileStats(fd, stats))
+#define ISFS_Read(fd, buffer, length)	TRACED("ISFS_Read", fd, NULL, length, ISFS_Read(fd, buffer, length))
+#define ISFS_Write(fd, buffer, length)	TRACED("ISFS_Write", fd, NULL, length, ISFS_Write(fd, buffer, length))
+#define ISFS_Seek(fd, where, whence)	TRACED("ISFS_Seek", fd, NULL, 0, ISFS_Seek(fd, where, whence))
+#define ISFS_CreateFile(path, attributes, owner, group, other) \
+	TRACED("ISFS_CreateFile", 0, path, 0, ISFS_CreateFile(path, attributes, owner, group, other))
+#define ISFS_Delete(path)				TRACED("ISFS_Delete", 0, path, 0, ISFS_Delete(path))
+#define ISFS_Close(fd)					TRACED("ISFS_Close", fd, NULL, 0, ISFS_Close(fd))
+#define ISFS_GetStats(stats)			TRACED("ISFS_GetStats", 0, NULL, 0, ISFS_GetStats(stats))
+#define ISFS_GetUsage(path, clusters, inodes) \
+	TRACED("ISFS_GetUsage", 0, path, 0, ISFS_GetUsage(path, clusters, inodes))
+#else
+#define TraceRecord(call, arg, detail, bytes, start, ret)	((void)0)
+#define TracePrint()										((void)0)
+#define TraceDump(path)										((void)0)
+#endif
+
+/*
+ * `make RECORD=1` (which implies IPCTRACE) also writes every traced call and every HTTP request to a
+ * session trace on SD, to be replayed later with tools/nus-standin.py --replay. One line per event:
+ *   H <ms> <duration ms> <status> <curl result> <offset> <bytes> <sha1 or -> <url>
+ *   I <ms> <us> <call> <arg> <bytes> <ret> <detail or ->
+ */
+#ifdef RECORD
+int  TraceStartRecording(const char* path);
+void TraceHTTP(const char* url, long status, int result, uint64_t offset, uint64_t bytes, uint64_t start, const unsigned char* hash);
+void TraceFlush(void);
+void TraceStopRecording(void);
+#else
+#define TraceStartRecording(path)										((void)0)
+#define TraceHTTP(url, status, result, offset, bytes, start, hash)		((void)0)
+#define TraceFlush()													((void)0)
+#define TraceStopRecording()											((void)0)
+#endif
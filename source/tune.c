@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ogc/lwp_watchdog.h>
+
+#include "tune.h"
+#include "arena.h"
+#include "nand.h"
+#include "es.h"
+
+#define TUNE_MIN_CHUNK     0x4000 // one NAND cluster
+#define TUNE_SIZES         6      // 16 KB .. 512 KB
+#define TUNE_MIN_BYTES     (512 << 10) // before a size counts at all
+#define TUNE_MAX_BYTES     (256 << 20) // then older numbers start fading out
+#define TUNE_EXPLORE_EVERY 16
+#define TUNE_CALIBRATE_BYTES (1 << 20) // read at each size
+
+typedef struct {
+	uint64_t bytes;
+	uint64_t us;
+} TuneSample;
+
+static TuneSample samples[TUNE_KINDS][TUNE_SIZES];
+static unsigned calls[TUNE_KINDS];
+static const char* const kind_names[TUNE_KINDS] = { "read", "write" };
+
+static int SizeIndex(uint32_t size) {
+	for (int i = 0; i < TUNE_SIZES; i++) {
+		if (size == (TUNE_MIN_CHUNK << i))
+			return i;
+	}
+
+	return -1;
+}
+
+static int Best(TuneKind kind) {
+	int best = -1;
+
+	for (int i = 0; i < TUNE_SIZES && (TUNE_MIN_CHUNK << i) <= ArenaBufferSize(); i++) {
+		TuneSample* sample = &samples[kind][i];
+		if (sample->bytes < TUNE_MIN_BYTES || !sample->us)
+			continue;
+
+		// Cross-multiplied, bytes / us as an integer is 0 or 1 at the speeds the NAND does.
+		if (best < 0 || sample->bytes * samples[kind][best].us > samples[kind][best].bytes * sample->us)
+			best = i;
+	}
+
+	return best;
+}
+
+uint32_t TuneChunk(TuneKind kind) {
+	int index = Best(kind);
+
+	// Never measured, so the whole buffer, like it always was.
+	if (index < 0)
+		return ArenaBufferSize();
+
+	if (++calls[kind] % TUNE_EXPLORE_EVERY == 0) {
+		index += ((calls[kind] / TUNE_EXPLORE_EVERY) & 1) ? 1 : -1;
+		if (index < 0) index = 1;
+		if (index >= TUNE_SIZES || (TUNE_MIN_CHUNK << index) > ArenaBufferSize()) index -= 2;
+	}
+
+	return TUNE_MIN_CHUNK << index;
+}
+
+// Only whole chunks of one of the sizes count. Called from IPC callbacks too, so nothing fancy.
+void TuneRecord(TuneKind kind, uint32_t size, uint64_t ticks) {
+	int index = SizeIndex(size);
+	if (index < 0)
+		return;
+
+	TuneSample* sample = &samples[kind][index];
+	sample->bytes += size;
+	sample->us    += ticks_to_microsecs(ticks);
+
+	if (sample->bytes > TUNE_MAX_BYTES) {
+		sample->bytes /= 2;
+		sample->us    /= 2;
+	}
+}
+
+int TuneLoad(const char* path) {
+	char line[96], kind[8];
+	unsigned size;
+	unsigned long long bytes, us;
+	int loaded = 0;
+
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	memset(samples, 0, sizeof(samples));
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%7s %u %llu %llu", kind, &size, &bytes, &us) != 4)
+			continue;
+
+		for (int k = 0; k < TUNE_KINDS; k++) {
+			int index = SizeIndex(size);
+			if (!strcmp(kind, kind_names[k]) && index >= 0) {
+				samples[k][index] = (TuneSample){ bytes, us };
+				loaded++;
+			}
+		}
+	}
+
+	fclose(fp);
+	return loaded ? 0 : -ENOENT;
+}
+
+int TuneSave(const char* path) {
+	if (Best(TUNE_NAND_READ) < 0 && Best(TUNE_ES_WRITE) < 0)
+		return 0;
+
+	FILE* fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	fputs("# <read|write> <chunk size> <bytes> <microseconds>, see tune.h\n", fp);
+	for (int k = 0; k < TUNE_KINDS; k++) {
+		for (int i = 0; i < TUNE_SIZES; i++) {
+			if (samples[k][i].bytes)
+				fprintf(fp, "%s %u %llu %llu\n", kind_names[k], TUNE_MIN_CHUNK << i, samples[k][i].bytes, samples[k][i].us);
+		}
+	}
+
+	return fclose(fp) ? -errno : 0;
+}
+
+// Enough of it read at this size, stop there.
+static int CountChunk(unsigned char* chunk, uint32_t length, uint32_t offset, void* userp) {
+	uint32_t* left = userp;
+
+	if (length >= *left) {
+		*left = 0;
+		return -ECANCELED;
+	}
+
+	*left -= length;
+	return 0;
+}
+
+/*
+ * Reads the System Menu's biggest content at each size, it's on every console and nothing's written.
+ * ES writes aren't measured here, AddContentData times them during real installs.
+ */
+int TuneCalibrate(void) {
+	int ret;
+	char path[64];
+	signed_blob* s_tmd = NULL;
+	uint32_t tmd_size = 0;
+	tmd_content* biggest = NULL;
+	size_t mark = ArenaMark();
+
+	ret = GetStoredTMD(0x0000000100000002, &s_tmd, &tmd_size);
+	if (ret < 0)
+		return ret;
+
+	tmd* p_tmd = SIGNATURE_PAYLOAD(s_tmd);
+	for (int i = 0; i < p_tmd->num_contents; i++) {
+		tmd_content* content = p_tmd->contents + i;
+
+		// Shared ones are somewhere else under another name.
+		if (!(content->type & 0x8000) && content->size && (!biggest || content->size > biggest->size))
+			biggest = content;
+	}
+
+	if (!biggest) {
+		ret = -ENOENT;
+		goto finish;
+	}
+
+	sprintf(path, "/title/00000001/00000002/content/%08x.app", biggest->cid);
+	for (int i = 0; i < TUNE_SIZES && (TUNE_MIN_CHUNK << i) <= ArenaBufferSize(); i++) {
+		uint32_t left = TUNE_CALIBRATE_BYTES;
+
+		// Small enough file, read it again.
+		while (left) {
+			ret = NANDStreamFile(path, TUNE_MIN_CHUNK << i, CountChunk, &left);
+			if (ret == -ECANCELED)
+				ret = 0;
+			if (ret < 0)
+				break;
+		}
+
+		if (ret < 0)
+			break;
+	}
+
+finish:
+	ArenaRelease(mark);
+	return ret;
+}
@@ -0,0 +1,21 @@
+#include <stdint.h>
+
+#define TUNE_PATH "sd:/restorer-tune.txt"
+
+typedef enum {
+	TUNE_NAND_READ, // ISFS reads (NANDStreamRun)
+	TUNE_ES_WRITE,  // ES_AddContentData
+	TUNE_KINDS,
+} TuneKind;
+
+/*
+ * How big each ISFS read and ES_AddContentData call should be on this console, out of 16 KB to the size of an
+ * arena I/O buffer. TuneCalibrate measures every read size on one of the System Menu's contents. ES writes start
+ * at the whole buffer and are measured by real installs only. Either way the real transfers keep adding to the
+ * numbers (now and then with the next size up or down), and they're kept on the SD card.
+ */
+int  TuneLoad(const char* path);
+int  TuneSave(const char* path);
+int  TuneCalibrate(void);
+uint32_t TuneChunk(TuneKind kind);
+void TuneRecord(TuneKind kind, uint32_t size, uint64_t ticks);
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ogc/es.h>
+#include <ogc/lwp_watchdog.h>
+
+#include "update.h"
+#include "nus.h"
+#include "arena.h"
+#include "network.h"
+#include "trace.h"
+#include "log.h"
+
+static char update_url[128] = NETUPDATE_URL;
+
+static const char* const SOAPHeaders[] = {
+	"Content-Type: text/xml; charset=utf-8",
+	"SOAPAction: urn:nus.wsapi.broadon.com/GetSystemUpdate",
+	"User-Agent: wii libnup/1.0",
+	NULL
+};
+
+void SetUpdateURL(const char* url) {
+	strncpy(update_url, url ?: NETUPDATE_URL, sizeof(update_url) - 1);
+}
+
+static int GetInstalledVersion(uint64_t titleID, uint16_t* version) {
+	struct Title title;
+
+	int ret = GetInstalledTitleTier(titleID, TITLE_VIEW, &title);
+	if (ret < 0)
+		return ret;
+
+	*version = TitleVersion(&title);
+	FreeTitle(&title);
+	return 0;
+}
+
+// The value of <tag>...</tag>, if it's somewhere before `end`.
+static const char* FindTag(const char* xml, const char* end, const char* tag) {
+	const char* found = strstr(xml, tag);
+
+	return (found && found < end) ? found + strlen(tag) : NULL;
+}
+
+int GetSystemUpdates(char region, TitleUpdate** updates, uint32_t* count) {
+	int ret;
+	uint32_t titlecnt = 0, deviceID = 0, n = 0;
+	uint64_t* titles;
+	uint16_t* versions;
+	char* request;
+	blob response = {};
+	const char* regionID = "USA", *country = "US";
+
+	switch (region) {
+		case 'J': regionID = "JPN"; country = "JP"; break;
+		case 'P': regionID = "EUR"; country = "GB"; break;
+		case 'K': regionID = "KOR"; country = "KR"; break;
+	}
+
+	*updates = NULL;
+	*count = 0;
+
+	ret = ES_GetNumTitles(&titlecnt);
+	if (ret < 0)
+		return ret;
+
+	titles   = ArenaAlloc(sizeof(uint64_t) * titlecnt);
+	versions = ArenaAlloc(sizeof(uint16_t) * titlecnt);
+	request  = ArenaAlloc(0x200 + (titlecnt * 0x60));
+	if (!titles || !versions || !request)
+		return -ENOMEM;
+
+	ret = ES_GetTitles(titles, titlecnt);
+	if (ret < 0)
+		return ret;
+
+	ES_GetDeviceID(&deviceID);
+
+	// Same thing the System Menu sends, installed versions and all.
+	char* ptr = request + sprintf(request,
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<soapenv:Envelope xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+		"xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\">\n"
+		"<soapenv:Body>\n<GetSystemUpdateRequest xmlns=\"urn:nus.wsapi.broadon.com\">\n"
+		"<Version>1.0</Version>\n<MessageId>%llu</MessageId>\n<DeviceId>%u</DeviceId>\n"
+		"<RegionId>%s</RegionId>\n<CountryCode>%s</CountryCode>\n",
+		gettime(), deviceID, regionID, country);
+
+	for (uint32_t i = 0; i < titlecnt; i++) {
+		// No TMD, not installed. (i.e. only a ticket or save data)
+		if (GetInstalledVersion(titles[i], &versions[i]) < 0) {
+			titles[i] = 0;
+			continue;
+		}
+
+		ptr += sprintf(ptr, "<TitleVersion><TitleId>%016llX</TitleId><Version>%hu</Version></TitleVersion>\n", titles[i], versions[i]);
+	}
+
+	ptr += sprintf(ptr, "<Attribute>2</Attribute>\n<AuditData>1</AuditData>\n</GetSystemUpdateRequest>\n</soapenv:Body>\n</soapenv:Envelope>\n");
+
+	LogPrintf("\t>> Asking for the system update list...\n");
+	ret = PostData(update_url, SOAPHeaders, request, ptr - request, &response);
+	if (ret < 0)
+		return ret;
+
+	// Terminate it for strstr
+	if (!WriteToBlob("", 1, 1, &response))
+		return -ENOMEM;
+
+	const char* xml = response.ptr;
+	if (!strstr(xml, "<ErrorCode>0</ErrorCode>") && strstr(xml, "<ErrorCode>")) {
+		LogPrintf("\t>> The update server said no: %.64s\n", strstr(xml, "<ErrorCode>"));
+		return -EPROTO;
+	}
+
+	// One entry for each <TitleVersion>, which is more than enough.
+	uint32_t max = 0;
+	for (const char* p = xml; (p = strstr(p, "<TitleVersion>")); p++)
+		max++;
+
+	TitleUpdate* list = ArenaAlloc(sizeof(TitleUpdate) * (max ?: 1));
+	if (!list)
+		return -ENOMEM;
+
+	for (const char* p = xml; (p = strstr(p, "<TitleVersion>")) && n < max; p++) {
+		const char* end = strstr(p, "</TitleVersion>");
+		const char* tid = FindTag(p, end, "<TitleId>"), *version = FindTag(p, end, "<Version>");
+		if (!end || !tid || !version)
+			continue;
+
+		TitleUpdate* update = list + n++;
+		update->titleID      = strtoull(tid, NULL, 16);
+		update->latest       = strtoul(version, NULL, 10);
+		update->is_installed = false;
+
+		for (uint32_t i = 0; i < titlecnt; i++) {
+			if (titles[i] && titles[i] == update->titleID) {
+				update->installed    = versions[i];
+				update->is_installed = true;
+				break;
+			}
+		}
+	}
+
+	*updates = list;
+	*count   = n;
+	return 0;
+}
@@ -0,0 +1,19 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NETUPDATE_URL "http://nus.shop.wii.com/nus/services/NetUpdateSOAP"
+
+typedef struct TitleUpdate {
+	int64_t  titleID;
+	uint16_t latest;
+	uint16_t installed;
+	bool     is_installed;
+} TitleUpdate;
+
+#define TitleOutdated(update) ((update)->is_installed && (update)->installed < (update)->latest)
+
+// Where GetSystemUpdates() asks. NULL for the real thing.
+void SetUpdateURL(const char* url);
+
+// One SOAP request (NetUpdate's GetSystemUpdate) for the whole system update list. Allocates from the arena.
+int GetSystemUpdates(char region, TitleUpdate** updates, uint32_t* count);
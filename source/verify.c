@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ogc/es.h>
+#include <ogc/isfs.h>
+
+#include "verify.h"
+#include "es.h"
+#include "nand.h"
+#include "arena.h"
+#include "crypto.h"
+#include "trace.h"
+
+static int HashChunk(unsigned char* chunk, uint32_t length, uint32_t offset, void* userp) {
+	return HashUpdate(userp, chunk, length);
+}
+
+static int VerifyContent(const char* path, tmd_content* content) {
+	int ret;
+	NANDStream nand;
+	HashContext sha;
+
+	ret = NANDStreamOpen(&nand, path);
+	if (ret < 0)
+		return ret;
+
+	if (nand.size != content->size) {
+		NANDStreamClose(&nand);
+		return -EIO;
+	}
+
+	HashInit(&sha, content->size);
+	ret = NANDStreamRun(&nand, 0, HashChunk, &sha);
+	NANDStreamClose(&nand);
+
+	if (ret < 0) {
+		sha1 discard;
+		HashFinish(&sha, discard);
+		return ret;
+	}
+
+	return CheckHashFinish(&sha, content->hash) ? 0 : -EIO;
+}
+
+// Contents on the NAND are stored decrypted, so there is nothing to decrypt here, just hash.
+int VerifyTitle(int64_t titleID, VerifyResult* result) {
+	int ret;
+	size_t mark = ArenaMark();
+	signed_blob* s_tmd = NULL;
+	uint32_t tmd_size = 0;
+	char path[ISFS_MAXPATH];
+
+	memset(result, 0, sizeof(VerifyResult));
+	result->titleID = titleID;
+
+	ret = GetStoredTMD(titleID, &s_tmd, &tmd_size);
+	if (ret < 0)
+		return ret;
+
+	tmd* p_tmd = SIGNATURE_PAYLOAD(s_tmd);
+	SharedContentLookup shared = { p_tmd, .names = ArenaAlloc(p_tmd->num_contents * sizeof(*shared.names)) };
+	if (!shared.names) {
+		ret = -ENOMEM;
+		goto finish;
+	}
+
+	ret = LookupSharedContents(&shared);
+	if (ret < 0)
+		goto finish;
+
+	result->num_contents = p_tmd->num_contents;
+	for (int i = 0; i < p_tmd->num_contents; i++) {
+		tmd_content* content = p_tmd->contents + i;
+
+		if (content->type & 0x8000) {
+			if (!SharedContentFound(&shared, i)) {
+				result->missing++;
+				continue;
+			}
+
+			sprintf(path, "/shared1/%.8s.app", shared.names[i]);
+		}
+		else {
+			sprintf(path, "/title/%08x/%08x/content/%08x.app", (uint32_t)(titleID >> 32), (uint32_t)titleID, content->cid);
+		}
+
+		ret = VerifyContent(path, content);
+		if (ret == -106) {
+			// Optional contents (DLC and such) don't have to be there.
+			if (!(content->type & 0x4000))
+				result->missing++;
+			continue;
+		}
+
+		if (ret < 0)
+			result->corrupt++;
+
+		result->checked++;
+	}
+
+	ret = 0;
+
+finish:
+	ArenaRelease(mark);
+	return ret;
+}
+
+/*
+ * Only the titles that failed end up in `failed`, as many as fit. Every title gets checked regardless,
+ * and `count` comes back as how many failed in total, which can be more than made it into `failed`.
+ * Returns how many titles were checked.
+ */
+int VerifyAllTitles(VerifyResult* failed, uint32_t* count) {
+	int ret;
+	size_t mark = ArenaMark();
+	uint32_t titlecnt = 0, n = 0;
+	uint64_t* titles;
+	VerifyResult overflow;
+
+	ret = ES_GetNumTitles(&titlecnt);
+	if (ret < 0)
+		return ret;
+
+	titles = ArenaAlloc(sizeof(uint64_t) * titlecnt);
+	if (!titles)
+		return -ENOMEM;
+
+	ret = ES_GetTitles(titles, titlecnt);
+	if (ret < 0)
+		goto finish;
+
+	ret = 0;
+	for (uint32_t i = 0; i < titlecnt; i++) {
+		VerifyResult* result = (n < *count) ? &failed[n] : &overflow;
+
+		// No TMD, no title. (i.e. only a ticket or save data)
+		if (VerifyTitle(titles[i], result) < 0)
+			continue;
+
+		ret++;
+		if (VerifyFailed(result))
+			n++;
+	}
+
+	*count = n;
+
+finish:
+	ArenaRelease(mark);
+	return ret;
+}
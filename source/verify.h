@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+typedef struct VerifyResult {
+	int64_t  titleID;
+	uint16_t num_contents;
+	uint16_t checked; // actually hashed, i.e. not missing
+	uint16_t corrupt;
+	uint16_t missing;
+} VerifyResult;
+
+#define VerifyFailed(result) ((result)->corrupt || (result)->missing)
+
+int VerifyTitle(int64_t titleID, VerifyResult* result);
+int VerifyAllTitles(VerifyResult* failed, uint32_t* count);
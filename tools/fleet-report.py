@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+"""
+Sums up restore reports from any number of consoles: the <device ID>.txt files headless runs write
+(`reports = ...` in restorer.ini), and the session traces from `make RECORD=1` builds
+(sd:/restorer-session.trc) if there are any, for the per-content numbers.
+
+Prints percentiles per channel (time, download throughput, retries), per console type and region,
+per server, and per content from the traces. Consoles and servers whose throughput is way off
+everyone else's get flagged. With --baseline, the same numbers for another build side by side.
+
+Point it at files or directories; directories are searched for *.txt and *.trc.
+"""
+
+import argparse
+import collections
+import os
+import re
+import statistics
+import sys
+
+HEADER_RE = re.compile(r"^System Channel Restorer (?P<version>\S+)")
+CONSOLE_RE = re.compile(r"^Console: (?P<device>[0-9A-F]{8}), (?P<type>[^,]+), (?P<region>.+)$")
+SERVER_RE = re.compile(r"^Server:\s+(?P<server>\S+)")
+MEMORY_RE = re.compile(r"^Memory:\s+(?P<peak>\d+)/(?P<ceiling>\d+) KB")
+CHANNEL_RE = re.compile(r"^(?P<name>.{24}) (?P<status>OK|FAILED)\s+(?P<time>\d+) ms\s+(?P<kb>\d+) KB"
+                        r"(?:\s+(?P<download>\d+) ms download\s+(?P<retries>\d+) retries)?")
+HTTP_RE = re.compile(r"^H (?P<when>\d+) (?P<duration>\d+) (?P<status>-?\d+) (?P<result>-?\d+) (?P<offset>\d+) (?P<bytes>\d+) "
+                     r"(?P<hash>\S+) (?P<url>\S+)$")
+IPC_RE = re.compile(r"^I (?P<when>\d+) (?P<us>\d+) (?P<call>\S+) (?P<arg>[0-9a-f]+) (?P<bytes>\d+) (?P<ret>-?\d+)")
+CONTENT_URL_RE = re.compile(r"/ccs/download/(?P<tid>[0-9a-fA-F]{16})/(?P<file>[0-9a-fA-F]{8}|tmd(?:\.\d+)?|cetk)$")
+
+# How far (in median absolute deviations) from the fleet median before something gets flagged.
+OUTLIER_MADS = 3.0
+
+Report = collections.namedtuple("Report", "path version device type region server peak channels")
+Channel = collections.namedtuple("Channel", "name ok time kb download retries")
+
+
+def parse_report(path):
+    version = device = ctype = region = server = None
+    peak = None
+    channels = []
+
+    with open(path, errors="replace") as fp:
+        for line in fp:
+            line = line.rstrip("\n")
+            if m := HEADER_RE.match(line):
+                version = m["version"]
+            elif m := CONSOLE_RE.match(line):
+                device, ctype, region = m["device"], m["type"], m["region"]
+            elif m := SERVER_RE.match(line):
+                server = m["server"]
+            elif m := MEMORY_RE.match(line):
+                peak = int(m["peak"])
+            elif m := CHANNEL_RE.match(line):
+                channels.append(Channel(m["name"].strip(), m["status"] == "OK", int(m["time"]), int(m["kb"]),
+                                        int(m["download"]) if m["download"] else None,
+                                        int(m["retries"]) if m["retries"] else None))
+
+    if not version or not device:
+        return None
+
+    return Report(path, version, device, ctype, region, server, peak, channels)
+
+
+def parse_trace(path):
+    """(content downloads, ES time per call). Downloads are (tid/file, bytes, ms, attempts)."""
+    spans = collections.OrderedDict()
+    ipc = collections.defaultdict(list)
+
+    with open(path, errors="replace") as fp:
+        for line in fp:
+            if m := HTTP_RE.match(line):
+                c = CONTENT_URL_RE.search(m["url"])
+                if not c:
+                    continue
+                key = f"{c['tid'].lower()}/{c['file'].lower()}"
+                when, duration, offset, bytes_ = int(m["when"]), int(m["duration"]), int(m["offset"]), int(m["bytes"])
+                span = spans.setdefault(key, {"bytes": 0, "first": when, "last": when, "retries": 0, "failed": set()})
+
+                # Segmented downloads write a line per range, and those run side by side, so the time is
+                # from the first one starting to the last one ending. A retry picks up where a failed
+                # attempt left off, every other line is just another range of the same download.
+                span["bytes"] += bytes_
+                span["first"] = min(span["first"], when)
+                span["last"] = max(span["last"], when + duration)
+                if offset in span["failed"]:
+                    span["failed"].discard(offset)
+                    span["retries"] += 1
+                if int(m["result"]) != 0:
+                    span["failed"].add(offset + bytes_)
+            elif m := IPC_RE.match(line):
+                ipc[m["call"]].append((int(m["us"]), int(m["bytes"])))
+
+    downloads = collections.OrderedDict((key, (span["bytes"], span["last"] - span["first"], span["retries"] + 1))
+                                        for key, span in spans.items())
+    return downloads, ipc
+
+
+def find_files(paths):
+    for path in paths:
+        if os.path.isdir(path):
+            for root, _, files in os.walk(path):
+                for name in sorted(files):
+                    if name.endswith((".txt", ".trc")):
+                        yield os.path.join(root, name)
+        else:
+            yield path
+
+
+def load(paths):
+    reports, traces = [], []
+    for path in find_files(paths):
+        if path.endswith(".trc"):
+            traces.append(parse_trace(path))
+        elif report := parse_report(path):
+            reports.append(report)
+
+    return reports, traces
+
+
+def percentiles(values):
+    """p50/p90/p99 (and count), or None with nothing to go on."""
+    values = sorted(values)
+    if not values:
+        return None
+
+    def pick(p):
+        return values[min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))]
+
+    return len(values), pick(50), pick(90), pick(99)
+
+
+def fmt(stats, unit=""):
+    if not stats:
+        return f"{'-':>36}"
+    n, p50, p90, p99 = stats
+    return f"{n:5} {p50:9.0f}{unit} {p90:9.0f}{unit} {p99:9.0f}{unit}"
+
+
+def throughput(kb, ms):
+    return kb / (ms / 1000) if ms else None
+
+
+def outliers(groups):
+    """The groups whose median is more than OUTLIER_MADS away from the median of all of them."""
+    medians = {name: statistics.median(values) for name, values in groups.items() if values}
+    if len(medians) < 3:
+        return []
+
+    center = statistics.median(medians.values())
+    mad = statistics.median(abs(m - center) for m in medians.values()) or 1
+    return sorted((name, m, center) for name, m in medians.items() if abs(m - center) / mad > OUTLIER_MADS)
+
+
+def summarize(reports, traces):
+    """Every number the tables print, keyed by (table, row, column)."""
+    out = collections.OrderedDict()
+
+    by_channel = collections.defaultdict(list)
+    for report in reports:
+        for ch in report.channels:
+            by_channel[ch.name].append(ch)
+
+    for name, chs in sorted(by_channel.items()):
+        out[("channel", name, "time ms")] = percentiles([c.time for c in chs if c.ok])
+        out[("channel", name, "KB/s")] = percentiles([t for c in chs if c.ok and (t := throughput(c.kb, c.download or c.time))])
+        out[("channel", name, "retries")] = percentiles([c.retries for c in chs if c.retries is not None])
+        out[("channel", name, "failed %")] = (len(chs), *([100 * sum(not c.ok for c in chs) / len(chs)] * 3))
+
+    for key, label in ((lambda r: f"{r.type}, {r.region}", "console"), (lambda r: r.server, "server")):
+        groups = collections.defaultdict(list)
+        for report in reports:
+            groups[key(report)] += [t for c in report.channels if c.ok and (t := throughput(c.kb, c.download or c.time))]
+        for name, values in sorted(groups.items()):
+            out[(label, name, "KB/s")] = percentiles(values)
+
+    out[("session", "memory", "peak KB")] = percentiles([r.peak for r in reports if r.peak is not None])
+
+    contents = collections.defaultdict(list)
+    attempts = collections.defaultdict(list)
+    ipc = collections.defaultdict(list)
+    for downloads, calls in traces:
+        for key, (bytes_, ms, tries) in downloads.items():
+            if (t := throughput(bytes_ / 1024, ms)) is not None:
+                contents[key].append(t)
+            attempts[key].append(tries)
+        for call, samples in calls.items():
+            ipc[call] += [us for us, _ in samples]
+
+    for key in sorted(contents):
+        out[("content", key, "KB/s")] = percentiles(contents[key])
+        out[("content", key, "attempts")] = percentiles(attempts[key])
+    for call in sorted(ipc):
+        out[("ipc", call, "us")] = percentiles(ipc[call])
+
+    return out
+
+
+def print_tables(summary, baseline=None):
+    last_table = None
+    for (table, row, column), stats in summary.items():
+        if table != last_table:
+            print(f"\n== {table} ==")
+            print(f"{'':44} {'':14} {'n':>5} {'p50':>9} {'p90':>9} {'p99':>9}" + ("   baseline p50   change" if baseline is not None else ""))
+            last_table = table
+
+        line = f"{row[:44]:44} {column:14} {fmt(stats)}"
+        if baseline is not None:
+            old = baseline.get((table, row, column))
+            if old and stats and old[1]:
+                line += f"   {old[1]:12.0f}   {100 * (stats[1] - old[1]) / old[1]:+6.1f}%"
+            else:
+                line += f"   {'-':>12}"
+        print(line)
+
+
+def print_outliers(reports):
+    flagged = False
+    for label, key in (("console", lambda r: f"{r.device} ({r.type}, {r.region})"), ("server", lambda r: r.server)):
+        groups = collections.defaultdict(list)
+        for report in reports:
+            groups[key(report)] += [t for c in report.channels if c.ok and (t := throughput(c.kb, c.download or c.time))]
+
+        for name, median, center in outliers(groups):
+            if not flagged:
+                print("\n== outliers ==")
+                flagged = True
+            print(f"{label} {name}: {median:.0f} KB/s, everyone else {center:.0f} KB/s")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("paths", nargs="+", help="reports, traces, or directories of them")
+    parser.add_argument("--baseline", nargs="+", metavar="PATH", help="another build's reports to compare against")
+    args = parser.parse_args()
+
+    reports, traces = load(args.paths)
+    if not reports and not traces:
+        sys.exit("No reports or traces found.")
+
+    versions = sorted({r.version for r in reports})
+    print(f"{len(reports)} reports from {len({r.device for r in reports})} consoles, {len(traces)} traces, "
+          f"build {', '.join(versions) or '?'}")
+
+    baseline = None
+    if args.baseline:
+        old_reports, old_traces = load(args.baseline)
+        baseline = summarize(old_reports, old_traces)
+        print(f"Baseline: {len(old_reports)} reports, {len(old_traces)} traces, "
+              f"build {', '.join(sorted({r.version for r in old_reports})) or '?'}")
+
+    print_tables(summarize(reports, traces), baseline)
+    print_outliers(reports)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <ogc/isfs.h>
+#include <ogc/lwp_watchdog.h>
+
+#include "arena.h"
+#include "bench.h"
+#include "network.h"
+#include "nus.h"
+#include "trace.h"
+
+// Same as the console's (see main.c).
+#define SESSION_MEMORY_CEILING	(4 << 20)
+#define SESSION_IOBUF_SIZE		(512 << 10)
+#define SESSION_IOBUF_COUNT		2
+
+// A small one, one that isn't a multiple of 16, and one that gets downloaded in segments, over more than one window.
+static const uint32_t FixtureSizes[] = { 500, 0x23456, 0x1A0000 };
+#define FIXTURE_CONTENTS (sizeof(FixtureSizes) / sizeof(uint32_t))
+
+static int Usage(const char* argv0) {
+	fprintf(stderr,
+			"usage: %s bench [server]              the benchmarks in bench.c, and downloads from server (nus-standin.py)\n"
+			"       %s fixture <dir> <title ID>     a made-up title for nus-standin.py to serve out of dir\n"
+			"       %s replay <server> <title ID>... installs each title from server with ES emulated, taking as long as\n"
+			"                                        server/trace says the console's ES did, if there is one\n"
+			"       %s stage <server> <dir> <title ID>...\n"
+			"                                        downloads each title into a cache (dir), keeping what's there if it checks out\n"
+			"       %s snapshot <server> <dir> <title ID>\n"
+			"                                        installs the title, then purges it with a snapshot in dir and fails the\n"
+			"                                        reinstall, and checks it comes back the same\n"
+			"\n"
+			"The NAND is ./nand, or $RESTORER_NAND.\n",
+			argv0, argv0, argv0, argv0, argv0);
+	return 2;
+}
+
+static int WriteFixtureFile(const char* dir, int64_t titleID, const char* name, const void* data, size_t size,
+							const void* certs, size_t certs_size) {
+	char path[256];
+	FILE* fp;
+
+	sprintf(path, "%s/%016llx", dir, titleID);
+	mkdir(dir, 0755);
+	mkdir(path, 0755);
+
+	sprintf(path, "%s/%016llx/%s", dir, titleID, name);
+	fp = fopen(path, "wb");
+	if (!fp)
+		return -errno;
+
+	fwrite(data, 1, size, fp);
+	if (certs)
+		fwrite(certs, 1, certs_size, fp);
+
+	int ret = ferror(fp) ? -EIO : 0;
+	fclose(fp);
+	return ret;
+}
+
+static void MakeFixtureCert(void* signature, uint32_t sigtype, cert_rsa2048* cert, const char* issuer, const char* name) {
+	((sig_rsa2048*)signature)->type = sigtype;
+	cert->cert_type = 0x00000001;
+	strcpy(cert->issuer, issuer);
+	strncpy((char*)cert->cert_name, name, sizeof(cert->cert_name));
+}
+
+// Laid out like NUS has it: the TMD and ticket with their certs after them, and the contents encrypted.
+static int MakeFixture(const char* dir, int64_t titleID) {
+	int ret;
+	struct Title title = { .id = titleID };
+	char name[16];
+
+	title.certs = ArenaAlloc(sizeof(RetailCerts));
+	memset(title.certs, 0, sizeof(RetailCerts));
+	MakeFixtureCert(&title.certs->CA.signature, ES_SIG_RSA4096, &title.certs->CA.cert, "Root", "CA00000001");
+	MakeFixtureCert(&title.certs->XS.signature, ES_SIG_RSA2048, &title.certs->XS.cert, "Root-CA00000001", "XS00000003");
+	MakeFixtureCert(&title.certs->CP.signature, ES_SIG_RSA2048, &title.certs->CP.cert, "Root-CA00000001", "CP00000004");
+
+	title.tik_size = STD_SIGNED_TIK_SIZE;
+	title.s_tik = ArenaAlloc(title.tik_size);
+	memset(title.s_tik, 0, title.tik_size);
+	((sig_rsa2048*)title.s_tik)->type = ES_SIG_RSA2048;
+	title.ticket = SIGNATURE_PAYLOAD(title.s_tik);
+	title.ticket->titleid = titleID;
+	for (int i = 0; i < sizeof(aeskey); i++)
+		title.crypto.key[i] = rand();
+
+	TitleCryptoWrap(&title.crypto, title.ticket, 0);
+
+	title.tmd_size = sizeof(sig_rsa2048) + sizeof(tmd) + (sizeof(tmd_content) * FIXTURE_CONTENTS);
+	title.s_tmd = ArenaAlloc(title.tmd_size);
+	memset(title.s_tmd, 0, title.tmd_size);
+	((sig_rsa2048*)title.s_tmd)->type = ES_SIG_RSA2048;
+	title.tmd = SIGNATURE_PAYLOAD(title.s_tmd);
+	title.tmd->title_id = titleID;
+	title.tmd->title_version = 1;
+	title.tmd->num_contents = FIXTURE_CONTENTS;
+
+	unsigned char* buffer = ArenaAlloc(__builtin_align_up(FixtureSizes[FIXTURE_CONTENTS - 1], 0x10));
+	for (int i = 0; i < FIXTURE_CONTENTS; i++) {
+		tmd_content* content = title.tmd->contents + i;
+		size_t size = __builtin_align_up(FixtureSizes[i], 0x10);
+		aesiv iv = ContentIV(i);
+
+		content->cid   = 0x10 + i;
+		content->index = i;
+		content->type  = 0x0001;
+		content->size  = FixtureSizes[i];
+
+		memset(buffer, 0, size);
+		for (size_t j = 0; j < content->size; j++)
+			buffer[j] = rand();
+
+		mbedtls_sha1_ret(buffer, content->size, content->hash);
+		mbedtls_aes_crypt_cbc(TitleCryptoSchedule(&title.crypto, MBEDTLS_AES_ENCRYPT), MBEDTLS_AES_ENCRYPT, size,
+							  iv.full, buffer, buffer);
+
+		sprintf(name, "%08x", content->cid);
+		ret = WriteFixtureFile(dir, titleID, name, buffer, size, NULL, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = WriteFixtureFile(dir, titleID, "tmd", title.s_tmd, title.tmd_size, title.certs, sizeof(RetailCerts));
+	if (!ret)
+		ret = WriteFixtureFile(dir, titleID, "cetk", title.s_tik, title.tik_size, title.certs, sizeof(RetailCerts));
+
+	if (!ret)
+		printf("%016llx v%hu, %zu contents, in %s\n", titleID, title.tmd->title_version, FIXTURE_CONTENTS, dir);
+
+	return ret;
+}
+
+static int InstallTitles(const char* server, char* titles[], int cnt) {
+	int ret, failed = 0;
+
+	SetNUSServer(server);
+	ResetDownloadStats();
+	u64 start = gettime();
+	for (int i = 0; i < cnt; i++) {
+		struct Title title;
+		int64_t titleID = strtoll(titles[i], NULL, 16);
+
+		printf("[*] %016llx\n", titleID);
+		ret = DownloadTitleMeta(titleID, -1, &title);
+		if (ret == 0) {
+			ret = InstallTitle(&title, false);
+			FreeTitle(&title);
+		}
+
+		if (ret < 0) {
+			printf("\t>> Failed! (%i, %s)\n", ret, GetLastDownloadError());
+			failed++;
+		}
+	}
+
+	const DownloadStats* stats = GetDownloadStats();
+	printf("\n%-16s %8u ms %10llu bytes %4u files %3u retries %2i failed\n",
+		   server, diff_msec(start, gettime()), stats->bytes, stats->files, stats->retries, failed);
+
+	SetNUSServer(NULL);
+	return failed ? 1 : 0;
+}
+
+// The same path RunRestoreBenchmark takes on the console, for one scenario.
+static int Replay(const char* server, char* titles[], int cnt) {
+	int ret;
+	char url[192];
+	blob trace = {};
+
+	ES = &ESEmulated;
+
+	sprintf(url, "%s/trace", server);
+	if (DownloadFile(url, DOWNLOAD_BLOB, &trace, NULL) == 0 && (ret = ESEmulatedReplay(trace.ptr, trace.size)) > 0)
+		printf("Replaying %i recorded ES calls.\n", ret);
+
+	ret = InstallTitles(server, titles, cnt);
+
+	ESEmulatedReplay(NULL, 0);
+	ES = &ESNative;
+	return ret;
+}
+
+/*
+ * nus.c's STAGING_DOWNLOAD, what the console does with "Download to cache". Whatever's already in dir
+ * goes through CheckStagedContent, so this is also how a cache made elsewhere gets checked.
+ */
+static int Stage(const char* server, const char* dir, char* titles[], int cnt) {
+	SetStaging(STAGING_DOWNLOAD, dir);
+	int ret = InstallTitles(server, titles, cnt);
+	SetStaging(STAGING_OFF, NULL);
+
+	return ret;
+}
+
+// Contents from `contents`, which doesn't have to be where the TMD and ticket came from.
+static int InstallFrom(const char* server, const char* contents, int64_t titleID, bool purge, u32* ms) {
+	int ret;
+	struct Title title;
+	u64 start = gettime();
+
+	SetNUSServer(server);
+	ret = DownloadTitleMeta(titleID, -1, &title);
+	if (ret == 0) {
+		SetNUSServer(contents);
+		ret = InstallTitle(&title, purge);
+		FreeTitle(&title);
+	}
+
+	SetNUSServer(NULL);
+	if (ms)
+		*ms = diff_msec(start, gettime());
+
+	return ret;
+}
+
+// Everything about the title on the NAND (ticket, TMD and contents) in one hash.
+static int HashInstalledTitle(int64_t titleID, sha1 out) {
+	int ret;
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	unsigned char buffer[0x4000];
+	struct Title title;
+	mbedtls_sha1_context sha;
+
+	ret = GetInstalledTitle(titleID, &title);
+	if (ret < 0)
+		return ret;
+
+	mbedtls_sha1_init(&sha);
+	mbedtls_sha1_starts_ret(&sha);
+	mbedtls_sha1_update_ret(&sha, (unsigned char*)title.s_tik, title.tik_size);
+	mbedtls_sha1_update_ret(&sha, (unsigned char*)title.s_tmd, title.tmd_size);
+
+	for (int i = 0; i < title.tmd->num_contents; i++) {
+		if (title.tmd->contents[i].type & 0x8000) continue;
+
+		sprintf(path, "%s/title/%08x/%08x/content/%08x.app", HostNAND, (uint32_t)(titleID >> 32), (uint32_t)titleID,
+				title.tmd->contents[i].cid);
+		FILE* fp = fopen(path, "rb");
+		if (!fp) {
+			ret = -errno;
+			break;
+		}
+
+		for (size_t read; (read = fread(buffer, 1, sizeof(buffer), fp));)
+			mbedtls_sha1_update_ret(&sha, buffer, read);
+
+		fclose(fp);
+	}
+
+	mbedtls_sha1_finish_ret(&sha, out);
+	mbedtls_sha1_free(&sha);
+	FreeTitle(&title);
+	return ret;
+}
+
+/*
+ * nus.c's snapshots, the whole way round: the title installed, then a purging reinstall whose contents
+ * can't be downloaded (nothing listens on port 9), so the snapshot has to go back on. Before that, the
+ * same purging reinstall with and without a snapshot, for what taking one costs.
+ */
+static int SnapshotRoundTrip(const char* server, const char* dir, int64_t titleID) {
+	int ret;
+	char path[256];
+	struct stat st;
+	struct Title title;
+	sha1 before, after;
+	u32 plain_ms, snap_ms;
+	size_t plain_peak;
+
+	// The console has its own, here it's whatever the server sent along.
+	sprintf(path, "%s/sys", HostNAND);
+	mkdir(path, 0755);
+	strcat(path, "/cert.sys");
+	SetNUSServer(server);
+	if (stat(path, &st) < 0 && DownloadTitleMeta(titleID, -1, &title) == 0) {
+		FILE* fp = fopen(path, "wb");
+		if (fp) {
+			fwrite(title.certs, 1, sizeof(RetailCerts), fp);
+			fclose(fp);
+		}
+		FreeTitle(&title);
+	}
+
+	ret = InstallFrom(server, server, titleID, false, NULL);
+	if (ret == 0)
+		ret = InstallFrom(server, server, titleID, true, &plain_ms);
+	if (ret < 0) {
+		fprintf(stderr, "Couldn't install it to begin with. (%i, %s)\n", ret, GetLastDownloadError());
+		return 1;
+	}
+	plain_peak = ArenaPeak();
+
+	SetSnapshotDir(dir);
+	ret = InstallFrom(server, server, titleID, true, &snap_ms);
+	if (ret < 0) {
+		fprintf(stderr, "Couldn't reinstall it with a snapshot. (%i, %s)\n", ret, GetLastDownloadError());
+		goto fail;
+	}
+
+	printf("\nPurge and reinstall: %u ms, %u with a snapshot first (%+.0f%%). Arena peak %zu KB, %zu with.\n\n",
+		   plain_ms, snap_ms, 100.0 * ((double)snap_ms - plain_ms) / (plain_ms ?: 1), plain_peak >> 10, ArenaPeak() >> 10);
+
+	ret = HashInstalledTitle(titleID, before);
+	if (ret == 0)
+		ret = InstallFrom(server, "http://127.0.0.1:9", titleID, true, NULL);
+	if (ret == 0) {
+		fprintf(stderr, "The reinstall was supposed to fail!\n");
+		goto fail;
+	}
+
+	ret = HashInstalledTitle(titleID, after);
+	if (ret < 0 || memcmp(before, after, sizeof(sha1))) {
+		fprintf(stderr, "It didn't come back the same. (%i)\n", ret);
+		goto fail;
+	}
+
+	sprintf(path, "%s/%016llx.snap", dir, titleID);
+	if (stat(path, &st) == 0) {
+		fprintf(stderr, "%s is still there.\n", path);
+		goto fail;
+	}
+
+	printf("\n%016llx came back the same, and the snapshot is gone.\n", titleID);
+	SetSnapshotDir(NULL);
+	return 0;
+
+fail:
+	SetSnapshotDir(NULL);
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	int ret = 0;
+
+	if (argc < 2)
+		return Usage(argv[0]);
+
+	ret = ArenaInit(SESSION_MEMORY_CEILING, SESSION_IOBUF_SIZE, SESSION_IOBUF_COUNT);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to reserve %u KB of memory! (%i)\n", SESSION_MEMORY_CEILING >> 10, ret);
+		return 1;
+	}
+
+	CryptoInit();
+	if (getenv("RESTORER_NAND"))
+		snprintf(HostNAND, sizeof(HostNAND), "%s", getenv("RESTORER_NAND"));
+
+	// make RECORD=1, same as the console's but in the working directory.
+	TraceStartRecording("restorer-session.trc");
+
+	if (!strcmp(argv[1], "bench")) {
+		RunBenchmarks();
+		if (argc > 2) {
+			network_init();
+			BenchDownloads(argv[2]);
+		}
+	}
+	else if (!strcmp(argv[1], "fixture") && argc == 4) {
+		ret = MakeFixture(argv[2], strtoll(argv[3], NULL, 16));
+		if (ret < 0) {
+			fprintf(stderr, "Failed to write the fixture! (%i)\n", ret);
+			ret = 1;
+		}
+	}
+	else if (!strcmp(argv[1], "replay") && argc > 3) {
+		ISFS_Initialize();
+		network_init();
+		ret = Replay(argv[2], argv + 3, argc - 3);
+	}
+	else if (!strcmp(argv[1], "stage") && argc > 4) {
+		ISFS_Initialize();
+		network_init();
+		ret = Stage(argv[2], argv[3], argv + 4, argc - 4);
+	}
+	else if (!strcmp(argv[1], "snapshot") && argc == 5) {
+		ISFS_Initialize();
+		network_init();
+		ret = SnapshotRoundTrip(argv[2], argv[3], strtoll(argv[4], NULL, 16));
+	}
+	else {
+		ret = Usage(argv[0]);
+	}
+
+	TraceStopRecording();
+	CryptoDeinit();
+	ArenaDeinit();
+	return ret;
+}
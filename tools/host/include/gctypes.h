@@ -0,0 +1,34 @@
+#ifndef __GCTYPES_H__
+#define __GCTYPES_H__
+
+/*
+ * Just enough of libogc to build the restore code on a PC, see tools/host/Makefile.
+ * The calls are stood in for in ogc.c.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+#define ATTRIBUTE_ALIGN(v)	__attribute__((aligned(v)))
+#define ATTRIBUTE_PACKED	__attribute__((packed))
+#ifndef __aligned
+#define __aligned(x)		__attribute__((aligned(x)))
+#endif
+
+// devkitPPC's compiler has these, the host's might not.
+#if !__has_builtin(__builtin_align_up)
+#define __builtin_align_up(x, a)	(((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+#define __builtin_align_down(x, a)	((x) & ~((__typeof__(x))(a) - 1))
+#define __builtin_is_aligned(x, a)	((((uintptr_t)(x)) & ((a) - 1)) == 0)
+#endif
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __AES_H__
+#define __AES_H__
+
+#include <gctypes.h>
+
+s32 AES_Init(void);
+s32 AES_Close(void);
+s32 AES_Encrypt(const void* key, u32 key_size, void* iv, u32 iv_size, const void* in_data, void* out_data, u32 data_size);
+s32 AES_Decrypt(const void* key, u32 key_size, void* iv, u32 iv_size, const void* in_data, void* out_data, u32 data_size);
+
+#endif
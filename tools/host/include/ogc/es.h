@@ -0,0 +1,221 @@
+#ifndef __ES_H__
+#define __ES_H__
+
+#include <gctypes.h>
+
+#define ES_SIG_RSA4096		0x10000
+#define ES_SIG_RSA2048		0x10001
+#define ES_SIG_ECDSA		0x10002
+
+#define ES_CERT_RSA4096		0
+#define ES_CERT_RSA2048		1
+#define ES_CERT_ECDSA		2
+
+#define ES_EINVAL			-4100
+#define ES_ENOENT			-106
+
+typedef u32 sigtype;
+typedef sigtype sigheader;
+typedef sigheader signed_blob;
+
+typedef u8 sha1[20];
+typedef u8 aeskey[16];
+typedef char sig_issuer[0x40];
+
+/*
+ * Everything ES hands over is big-endian, and so is everything NUS serves. On the console that's just how
+ * the CPU works. Here it's up to the compiler, so the code reading these fields works on real TMDs and tickets.
+ */
+#pragma scalar_storage_order big-endian
+
+typedef struct _sig_rsa2048 {
+	sigtype type;
+	u8 sig[256];
+	u8 fill[60];
+} ATTRIBUTE_PACKED sig_rsa2048;
+
+typedef struct _sig_rsa4096 {
+	sigtype type;
+	u8 sig[512];
+	u8 fill[60];
+} ATTRIBUTE_PACKED sig_rsa4096;
+
+typedef struct _sig_ecdsa {
+	sigtype type;
+	u8 sig[60];
+	u8 fill[64];
+} ATTRIBUTE_PACKED sig_ecdsa;
+
+typedef struct _tiklimit {
+	u32 tag;
+	u32 value;
+} ATTRIBUTE_PACKED tiklimit;
+
+typedef struct _tikview {
+	u32 view;
+	u64 ticketid;
+	u32 devicetype;
+	u64 titleid;
+	u16 access_mask;
+	u8 reserved[0x3c];
+	u8 cidx_mask[0x40];
+	u16 padding;
+	tiklimit limits[8];
+} ATTRIBUTE_PACKED tikview;
+
+typedef struct _tik {
+	sig_issuer issuer;
+	u8 fill[63];
+	aeskey cipher_title_key;
+	u8 fill2;
+	u64 ticketid;
+	u32 devicetype;
+	u64 titleid;
+	u16 access_mask;
+	u8 reserved[0x3c];
+	u8 cidx_mask[0x40];
+	u16 padding;
+	tiklimit limits[8];
+} ATTRIBUTE_PACKED tik;
+
+typedef struct _tmd_content {
+	u32 cid;
+	u16 index;
+	u16 type;
+	u64 size;
+	sha1 hash;
+} ATTRIBUTE_PACKED tmd_content;
+
+typedef struct _tmd {
+	sig_issuer issuer;
+	u8 version;
+	u8 ca_crl_version;
+	u8 signer_crl_version;
+	u8 fill2;
+	u64 sys_version;
+	u64 title_id;
+	u32 title_type;
+	u16 group_id;
+	u16 zero;
+	u16 region;
+	u8 ratings[16];
+	u8 reserved[12];
+	u8 ipc_mask[12];
+	u8 reserved2[18];
+	u32 access_rights;
+	u16 title_version;
+	u16 num_contents;
+	u16 boot_index;
+	u16 fill3;
+	tmd_content contents[];
+} ATTRIBUTE_PACKED tmd;
+
+typedef struct _tmd_view_content {
+	u32 cid;
+	u16 index;
+	u16 type;
+	u64 size;
+} ATTRIBUTE_PACKED tmd_view_content;
+
+typedef struct _tmdview {
+	u8 version;
+	u8 filler[3];
+	u64 sys_version;
+	u64 title_id;
+	u32 title_type;
+	u16 group_id;
+	u8 reserved[0x3e];
+	u16 title_version;
+	u16 num_contents;
+	tmd_view_content contents[];
+} ATTRIBUTE_PACKED tmd_view;
+
+typedef struct _cert_header {
+	sig_issuer issuer;
+	u32 cert_type;
+	char cert_name[64];
+	u32 cert_id;
+} ATTRIBUTE_PACKED cert_header;
+
+typedef struct _cert_rsa2048 {
+	sig_issuer issuer;
+	u32 cert_type;
+	char cert_name[64];
+	u32 cert_id;
+	u8 modulus[256];
+	u32 exponent;
+	u8 pad[0x34];
+} ATTRIBUTE_PACKED cert_rsa2048;
+
+typedef struct _cert_rsa4096 {
+	sig_issuer issuer;
+	u32 cert_type;
+	char cert_name[64];
+	u32 cert_id;
+	u8 modulus[512];
+	u32 exponent;
+	u8 pad[0x34];
+} ATTRIBUTE_PACKED cert_rsa4096;
+
+typedef struct _cert_ecdsa {
+	sig_issuer issuer;
+	u32 cert_type;
+	char cert_name[64];
+	u32 cert_id;
+	u8 r[30];
+	u8 s[30];
+	u8 pad[0x3c];
+} ATTRIBUTE_PACKED cert_ecdsa;
+
+#pragma scalar_storage_order default
+
+// A signed_blob's first word, the signature type, read the way the console would.
+#define SIGNATURE_TYPE(x)		(((sig_rsa2048*)(x))->type)
+
+#define SIGNATURE_SIZE(x) (\
+	(SIGNATURE_TYPE(x) == ES_SIG_RSA2048) ? sizeof(sig_rsa2048) : ( \
+	(SIGNATURE_TYPE(x) == ES_SIG_RSA4096) ? sizeof(sig_rsa4096) : ( \
+	(SIGNATURE_TYPE(x) == ES_SIG_ECDSA) ? sizeof(sig_ecdsa) : 0 )))
+
+#define CERTIFICATE_SIZE(x) (\
+	(((cert_header*)(x))->cert_type == ES_CERT_RSA2048) ? sizeof(cert_rsa2048) : ( \
+	(((cert_header*)(x))->cert_type == ES_CERT_RSA4096) ? sizeof(cert_rsa4096) : ( \
+	(((cert_header*)(x))->cert_type == ES_CERT_ECDSA) ? sizeof(cert_ecdsa) : 0 )))
+
+#define IS_VALID_SIGNATURE(x)	(SIGNATURE_SIZE(x) != 0)
+#define SIGNATURE_SIG(x)		(((u8*)(x)) + 4)
+#define SIGNATURE_PAYLOAD(x)	((void*)(((u8*)(x)) + SIGNATURE_SIZE(x)))
+
+#define TMD_SIZE(x)				(((x)->num_contents) * sizeof(tmd_content) + sizeof(tmd))
+#define SIGNED_TMD_SIZE(x)		(TMD_SIZE((tmd*)SIGNATURE_PAYLOAD(x)) + SIGNATURE_SIZE(x))
+#define SIGNED_TIK_SIZE(x)		(sizeof(tik) + SIGNATURE_SIZE(x))
+#define SIGNED_CERT_SIZE(x)		(CERTIFICATE_SIZE(SIGNATURE_PAYLOAD(x)) + SIGNATURE_SIZE(x))
+#define STD_SIGNED_TIK_SIZE		(sizeof(tik) + sizeof(sig_rsa2048))
+
+#define MAX_NUM_TMD_CONTENTS	512
+
+signed_blob* ES_NextCert(const signed_blob* certs);
+
+s32 ES_GetDeviceID(u32* device_id);
+s32 ES_GetNumTitles(u32* cnt);
+s32 ES_GetTitles(u64* titles, u32 cnt);
+s32 ES_GetTitleContentsCount(u64 titleID, u32* num);
+s32 ES_GetStoredTMDSize(u64 titleID, u32* size);
+s32 ES_GetStoredTMD(u64 titleID, signed_blob* stmd, u32 size);
+s32 ES_GetTMDViewSize(u64 titleID, u32* size);
+s32 ES_GetTMDView(u64 titleID, u8* data, u32 size);
+s32 ES_GetNumTicketViews(u64 titleID, u32* cnt);
+s32 ES_GetTicketViews(u64 titleID, tikview* views, u32 cnt);
+
+s32 ES_AddTicket(const signed_blob* tik, u32 tik_size, const signed_blob* certificates, u32 certificates_size, const signed_blob* crl, u32 crl_size);
+s32 ES_AddTitleStart(const signed_blob* tmd, u32 tmd_size, const signed_blob* certificates, u32 certificates_size, const signed_blob* crl, u32 crl_size);
+s32 ES_AddContentStart(u64 titleID, u32 cid);
+s32 ES_AddContentData(s32 cid, u8* data, u32 data_size);
+s32 ES_AddContentFinish(u32 cid);
+s32 ES_AddTitleFinish(void);
+s32 ES_AddTitleCancel(void);
+s32 ES_DeleteTitle(u64 titleID);
+s32 ES_DeleteTitleContent(u64 titleID);
+s32 ES_DeleteTicket(const tikview* view);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __IRQ_H__
+#define __IRQ_H__
+
+#include <gctypes.h>
+
+// No interrupts to turn off here. What they guard is only ever touched from one thread at a time.
+#define _CPU_ISR_Disable(level)		((level) = 0)
+#define _CPU_ISR_Restore(level)		((void)(level))
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __ISFS_H__
+#define __ISFS_H__
+
+#include <gctypes.h>
+
+#define ISFS_MAXPATH		64
+
+#define ISFS_OPEN_READ		0x01
+#define ISFS_OPEN_WRITE		0x02
+#define ISFS_OPEN_RW		(ISFS_OPEN_READ | ISFS_OPEN_WRITE)
+
+#define ISFS_OK				0
+#define ISFS_ENOMEM			-22
+#define ISFS_EINVAL			-101
+#define ISFS_EEXIST			-105
+#define ISFS_ENOENT			-106
+
+typedef struct _fstats {
+	u32 file_length;
+	u32 file_pos;
+} fstats;
+
+typedef s32 (*isfscallback)(s32 result, void* usrdata);
+
+s32 ISFS_Initialize(void);
+s32 ISFS_Deinitialize(void);
+
+s32 ISFS_Open(const char* filepath, u8 mode);
+s32 ISFS_Close(s32 fd);
+s32 ISFS_Read(s32 fd, void* buffer, u32 length);
+s32 ISFS_ReadAsync(s32 fd, void* buffer, u32 length, isfscallback cb, void* usrdata);
+s32 ISFS_Write(s32 fd, const void* buffer, u32 length);
+s32 ISFS_Seek(s32 fd, s32 where, s32 whence);
+s32 ISFS_GetFileStats(s32 fd, fstats* status);
+s32 ISFS_CreateFile(const char* filepath, u8 attributes, u8 owner_perm, u8 group_perm, u8 other_perm);
+s32 ISFS_Delete(const char* filepath);
+s32 ISFS_GetStats(void* stats);
+s32 ISFS_GetUsage(const char* filepath, u32* usage1, u32* usage2);
+
+// Not libogc's: the directory the NAND is in, see ogc.c.
+extern char HostNAND[256];
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __LWP_WATCHDOG_H__
+#define __LWP_WATCHDOG_H__
+
+#include <gctypes.h>
+
+// The console counts in timebase ticks. Here a tick is a nanosecond of CLOCK_MONOTONIC.
+#define ticks_to_secs(ticks)		((u64)(ticks) / 1000000000)
+#define ticks_to_millisecs(ticks)	((u64)(ticks) / 1000000)
+#define ticks_to_microsecs(ticks)	((u64)(ticks) / 1000)
+#define ticks_to_nanosecs(ticks)	((u64)(ticks))
+
+#define secs_to_ticks(sec)			((u64)(sec) * 1000000000)
+#define millisecs_to_ticks(msec)	((u64)(msec) * 1000000)
+#define microsecs_to_ticks(usec)	((u64)(usec) * 1000)
+#define nanosecs_to_ticks(nsec)		((u64)(nsec))
+
+u64 gettime(void);
+u32 diff_sec(u64 start, u64 end);
+u32 diff_msec(u64 start, u64 end);
+u32 diff_usec(u64 start, u64 end);
+u32 diff_nsec(u64 start, u64 end);
+
+#endif
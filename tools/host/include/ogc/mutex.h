@@ -0,0 +1,16 @@
+#ifndef __MUTEX_H__
+#define __MUTEX_H__
+
+#include <gctypes.h>
+
+#define LWP_MUTEX_NULL		0xffffffff
+
+typedef u32 mutex_t;
+
+s32 LWP_MutexInit(mutex_t* mutex, bool use_recursive);
+s32 LWP_MutexDestroy(mutex_t mutex);
+s32 LWP_MutexLock(mutex_t mutex);
+s32 LWP_MutexTryLock(mutex_t mutex);
+s32 LWP_MutexUnlock(mutex_t mutex);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __SEMAPHORE_H__
+#define __SEMAPHORE_H__
+
+#include <gctypes.h>
+
+#define LWP_SEM_NULL		0xffffffff
+
+typedef u32 sem_t;
+
+s32 LWP_SemInit(sem_t* sem, u32 start, u32 max);
+s32 LWP_SemDestroy(sem_t sem);
+s32 LWP_SemWait(sem_t sem);
+s32 LWP_SemPost(sem_t sem);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __SHA_H__
+#define __SHA_H__
+
+#include <gctypes.h>
+
+typedef struct {
+	u32 states[5];
+	u32 upper_length;
+	u32 lower_length;
+} sha_context;
+
+s32 SHA_Init(void);
+s32 SHA_Close(void);
+s32 SHA_InitializeContext(const sha_context* context);
+s32 SHA_Input(const sha_context* context, const void* data, u32 data_size);
+s32 SHA_Finalize(const sha_context* context, const void* data, u32 data_size, void* message_digest);
+s32 SHA_Calculate(const void* data, u32 data_size, void* message_digest);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __WIISOCKET_H__
+#define __WIISOCKET_H__
+
+// The host's own sockets are always up.
+int  wiisocket_init(void);
+void wiisocket_deinit(void);
+int  wiisocket_get_status(void);
+
+#endif
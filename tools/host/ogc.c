@@ -0,0 +1,884 @@
+/*
+ * Stand-ins for the bits of libogc the restore code uses, so it runs on a PC (see the Makefile).
+ *
+ * - The clock is CLOCK_MONOTONIC, threads, mutexes and semaphores are pthreads.
+ * - The NAND (ISFS) is a directory, HostNAND.
+ * - ES installs to and reads from that NAND, checking content hashes but no signatures.
+ * - /dev/aes and /dev/sha are mbedtls, with the same rules as the real thing: 16-byte keys and IVs,
+ *   32-byte aligned buffers, and whole 64-byte blocks until SHA_Finalize. Break them and you get the
+ *   same error the console would give you, instead of it quietly working here.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/sha1.h>
+
+#include <gctypes.h>
+#include <ogc/es.h>
+#include <ogc/isfs.h>
+#include <ogc/lwp.h>
+#include <ogc/mutex.h>
+#include <ogc/semaphore.h>
+#include <ogc/lwp_watchdog.h>
+#include <ogc/aes.h>
+#include <ogc/sha.h>
+#include <wiisocket.h>
+
+#include "crypto.h"
+
+#define IPC_EINVAL			-4
+
+#define HOST_MAX_THREADS	16
+#define HOST_MAX_MUTEXES	64
+#define HOST_MAX_SEMAPHORES	64
+
+char HostNAND[256] = "nand";
+
+/* Time */
+
+u64 gettime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+u32 diff_sec(u64 start, u64 end)  { return ticks_to_secs(end - start); }
+u32 diff_msec(u64 start, u64 end) { return ticks_to_millisecs(end - start); }
+u32 diff_usec(u64 start, u64 end) { return ticks_to_microsecs(end - start); }
+u32 diff_nsec(u64 start, u64 end) { return ticks_to_nanosecs(end - start); }
+
+/* Threads */
+
+static pthread_mutex_t handles = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	pthread_t thread;
+	bool used;
+} threads[HOST_MAX_THREADS];
+
+static struct {
+	pthread_mutex_t mutex;
+	bool used;
+} mutexes[HOST_MAX_MUTEXES];
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	u32 count, max;
+	bool used;
+} semaphores[HOST_MAX_SEMAPHORES];
+
+s32 LWP_CreateThread(lwp_t* thethread, void* (*entry)(void*), void* arg, void* stackbase, u32 stack_size, u8 prio) {
+	int ret = -1;
+
+	pthread_mutex_lock(&handles);
+	for (lwp_t i = 0; i < HOST_MAX_THREADS; i++) {
+		if (threads[i].used)
+			continue;
+
+		if (pthread_create(&threads[i].thread, NULL, entry, arg) == 0) {
+			threads[i].used = true;
+			*thethread = i;
+			ret = 0;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&handles);
+
+	return ret;
+}
+
+s32 LWP_JoinThread(lwp_t thethread, void** value_ptr) {
+	if (thethread >= HOST_MAX_THREADS || !threads[thethread].used)
+		return -1;
+
+	pthread_join(threads[thethread].thread, value_ptr);
+
+	pthread_mutex_lock(&handles);
+	threads[thethread].used = false;
+	pthread_mutex_unlock(&handles);
+	return 0;
+}
+
+// Threads that LWP_CreateThread didn't make (i.e. main) get a handle the first time they ask.
+lwp_t LWP_GetSelf(void) {
+	lwp_t self = LWP_THREAD_NULL;
+
+	pthread_mutex_lock(&handles);
+	for (lwp_t i = 0; i < HOST_MAX_THREADS; i++) {
+		if (threads[i].used && pthread_equal(threads[i].thread, pthread_self())) {
+			self = i;
+			break;
+		}
+
+		if (!threads[i].used && self == LWP_THREAD_NULL)
+			self = i;
+	}
+
+	if (self != LWP_THREAD_NULL && !threads[self].used) {
+		threads[self].thread = pthread_self();
+		threads[self].used = true;
+	}
+	pthread_mutex_unlock(&handles);
+
+	return self;
+}
+
+void LWP_YieldThread(void) {
+	sched_yield();
+}
+
+s32 LWP_MutexInit(mutex_t* mutex, bool use_recursive) {
+	pthread_mutexattr_t attr;
+	int ret = -1;
+
+	pthread_mutexattr_init(&attr);
+	if (use_recursive)
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+	pthread_mutex_lock(&handles);
+	for (mutex_t i = 0; i < HOST_MAX_MUTEXES; i++) {
+		if (mutexes[i].used)
+			continue;
+
+		pthread_mutex_init(&mutexes[i].mutex, &attr);
+		mutexes[i].used = true;
+		*mutex = i;
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&handles);
+
+	pthread_mutexattr_destroy(&attr);
+	return ret;
+}
+
+s32 LWP_MutexDestroy(mutex_t mutex) {
+	if (mutex >= HOST_MAX_MUTEXES || !mutexes[mutex].used)
+		return -1;
+
+	pthread_mutex_destroy(&mutexes[mutex].mutex);
+	mutexes[mutex].used = false;
+	return 0;
+}
+
+s32 LWP_MutexLock(mutex_t mutex)    { return -pthread_mutex_lock(&mutexes[mutex].mutex); }
+s32 LWP_MutexTryLock(mutex_t mutex) { return -pthread_mutex_trylock(&mutexes[mutex].mutex); }
+s32 LWP_MutexUnlock(mutex_t mutex)  { return -pthread_mutex_unlock(&mutexes[mutex].mutex); }
+
+s32 LWP_SemInit(sem_t* sem, u32 start, u32 max) {
+	int ret = -1;
+
+	pthread_mutex_lock(&handles);
+	for (sem_t i = 0; i < HOST_MAX_SEMAPHORES; i++) {
+		if (semaphores[i].used)
+			continue;
+
+		pthread_mutex_init(&semaphores[i].mutex, NULL);
+		pthread_cond_init(&semaphores[i].cond, NULL);
+		semaphores[i].count = start;
+		semaphores[i].max   = max;
+		semaphores[i].used  = true;
+		*sem = i;
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&handles);
+
+	return ret;
+}
+
+s32 LWP_SemDestroy(sem_t sem) {
+	if (sem >= HOST_MAX_SEMAPHORES || !semaphores[sem].used)
+		return -1;
+
+	pthread_cond_destroy(&semaphores[sem].cond);
+	pthread_mutex_destroy(&semaphores[sem].mutex);
+	semaphores[sem].used = false;
+	return 0;
+}
+
+s32 LWP_SemWait(sem_t sem) {
+	pthread_mutex_lock(&semaphores[sem].mutex);
+	while (!semaphores[sem].count)
+		pthread_cond_wait(&semaphores[sem].cond, &semaphores[sem].mutex);
+
+	semaphores[sem].count--;
+	pthread_mutex_unlock(&semaphores[sem].mutex);
+	return 0;
+}
+
+s32 LWP_SemPost(sem_t sem) {
+	pthread_mutex_lock(&semaphores[sem].mutex);
+	if (semaphores[sem].count < semaphores[sem].max)
+		semaphores[sem].count++;
+
+	pthread_cond_signal(&semaphores[sem].cond);
+	pthread_mutex_unlock(&semaphores[sem].mutex);
+	return 0;
+}
+
+/* ISFS */
+
+static s32 ISFSError(void) {
+	switch (errno) {
+		case ENOENT: return ISFS_ENOENT;
+		case EEXIST: return ISFS_EEXIST;
+		case ENOMEM: return ISFS_ENOMEM;
+		case EACCES: return -102;
+		default:     return ISFS_EINVAL;
+	}
+}
+
+static int ISFSPath(char* out, const char* filepath) {
+	if (!filepath || filepath[0] != '/' || strlen(filepath) >= ISFS_MAXPATH)
+		return ISFS_EINVAL;
+
+	sprintf(out, "%s%s", HostNAND, filepath);
+	return 0;
+}
+
+// A NAND with nothing installed still has a content.map, if it doesn't have one yet it's made here.
+s32 ISFS_Initialize(void) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	mkdir(HostNAND, 0755);
+	sprintf(path, "%s/shared1", HostNAND);
+	mkdir(path, 0755);
+
+	strcat(path, "/content.map");
+	int fd = open(path, O_CREAT | O_WRONLY, 0666);
+	if (fd < 0)
+		return ISFSError();
+
+	close(fd);
+	return 0;
+}
+
+s32 ISFS_Deinitialize(void) { return 0; }
+
+s32 ISFS_Open(const char* filepath, u8 mode) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	int flags;
+
+	if (ISFSPath(path, filepath) < 0)
+		return ISFS_EINVAL;
+
+	switch (mode) {
+		case ISFS_OPEN_READ:  flags = O_RDONLY; break;
+		case ISFS_OPEN_WRITE: flags = O_WRONLY; break;
+		case ISFS_OPEN_RW:    flags = O_RDWR; break;
+		default: return ISFS_EINVAL;
+	}
+
+	int fd = open(path, flags);
+	return (fd < 0) ? ISFSError() : fd;
+}
+
+s32 ISFS_Close(s32 fd) {
+	return close(fd) < 0 ? ISFSError() : 0;
+}
+
+s32 ISFS_Read(s32 fd, void* buffer, u32 length) {
+	if (!__builtin_is_aligned(buffer, 0x20))
+		return ISFS_EINVAL;
+
+	ssize_t ret = read(fd, buffer, length);
+	return (ret < 0) ? ISFSError() : ret;
+}
+
+// Done by the time it returns, the callback just comes early.
+s32 ISFS_ReadAsync(s32 fd, void* buffer, u32 length, isfscallback cb, void* usrdata) {
+	s32 ret = ISFS_Read(fd, buffer, length);
+
+	if (cb)
+		cb(ret, usrdata);
+
+	return 0;
+}
+
+s32 ISFS_Write(s32 fd, const void* buffer, u32 length) {
+	if (!__builtin_is_aligned(buffer, 0x20))
+		return ISFS_EINVAL;
+
+	ssize_t ret = write(fd, buffer, length);
+	return (ret < 0) ? ISFSError() : ret;
+}
+
+s32 ISFS_Seek(s32 fd, s32 where, s32 whence) {
+	off_t ret = lseek(fd, where, whence);
+	return (ret < 0) ? ISFSError() : ret;
+}
+
+s32 ISFS_GetFileStats(s32 fd, fstats* status) {
+	struct stat st;
+
+	if (!__builtin_is_aligned(status, 0x20))
+		return ISFS_EINVAL;
+
+	if (fstat(fd, &st) < 0)
+		return ISFSError();
+
+	status->file_length = st.st_size;
+	status->file_pos    = lseek(fd, 0, SEEK_CUR);
+	return 0;
+}
+
+s32 ISFS_CreateFile(const char* filepath, u8 attributes, u8 owner_perm, u8 group_perm, u8 other_perm) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	if (ISFSPath(path, filepath) < 0)
+		return ISFS_EINVAL;
+
+	int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0666);
+	if (fd < 0)
+		return ISFSError();
+
+	close(fd);
+	return 0;
+}
+
+s32 ISFS_Delete(const char* filepath) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	if (ISFSPath(path, filepath) < 0)
+		return ISFS_EINVAL;
+
+	return (remove(path) < 0) ? ISFSError() : 0;
+}
+
+// A 512 MB NAND with nothing on it, in /dev/fs's layout (see NANDStats).
+s32 ISFS_GetStats(void* stats) {
+	u32 nand[7] = { 0x4000, 0x8000, 0, 0, 0, 0x17FF, 0 };
+
+	memcpy(stats, nand, sizeof(nand));
+	return 0;
+}
+
+s32 ISFS_GetUsage(const char* filepath, u32* usage1, u32* usage2) {
+	*usage1 = *usage2 = 0;
+	return 0;
+}
+
+/* ES */
+
+signed_blob* ES_NextCert(const signed_blob* certs) {
+	if (!SIGNATURE_SIZE(certs))
+		return NULL;
+
+	if (!CERTIFICATE_SIZE(SIGNATURE_PAYLOAD(certs)))
+		return NULL;
+
+	return (signed_blob*)(((u8*)certs) + SIGNED_CERT_SIZE(certs));
+}
+
+s32 ES_GetDeviceID(u32* device_id) {
+	*device_id = 0x0403AC68;
+	return 0;
+}
+
+/*
+ * Titles go where IOS puts them: /ticket/<hi>/<lo>.tik, and /title/<hi>/<lo>/content/ with title.tmd and
+ * the contents decrypted, <cid>.app. Contents are decrypted and hashed as they come in, and wait in
+ * /import until AddTitleFinish. Shared contents are taken and thrown away, content.map stays empty.
+ */
+#define ES_EHASH			-1022
+
+static struct {
+	signed_blob* s_tmd;
+	u32 tmd_size;
+	tmd* tmd;
+	mbedtls_aes_context aes;
+	tmd_content* content; // the open one
+	int fd;
+	aesiv iv;
+	u64 left;
+	mbedtls_sha1_context sha;
+} import;
+
+static void TitlePath(char* out, u64 titleID, const char* name) {
+	sprintf(out, "%s/title/%08x/%08x%s%s", HostNAND, (u32)(titleID >> 32), (u32)titleID, name ? "/content/" : "", name ?: "");
+}
+
+static void TicketPath(char* out, u64 titleID) {
+	sprintf(out, "%s/ticket/%08x/%08x.tik", HostNAND, (u32)(titleID >> 32), (u32)titleID);
+}
+
+static void ImportPath(char* out, u32 cid) {
+	sprintf(out, "%s/import/%08x.app", HostNAND, cid);
+}
+
+// Every directory on the way to path.
+static void MakeParents(const char* path) {
+	char dir[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	strcpy(dir, path);
+	for (char* p = dir + strlen(HostNAND) + 1; (p = strchr(p, '/')); *p++ = '/') {
+		*p = 0;
+		mkdir(dir, 0755);
+	}
+}
+
+static void* ReadWhole(const char* path, u32* size) {
+	struct stat st;
+	void* data = NULL;
+
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+
+	if (fstat(fileno(fp), &st) == 0 && (data = aligned_alloc(0x20, __builtin_align_up(st.st_size, 0x20)))) {
+		if (fread(data, 1, st.st_size, fp) == st.st_size) {
+			*size = st.st_size;
+		} else {
+			free(data);
+			data = NULL;
+		}
+	}
+
+	fclose(fp);
+	return data;
+}
+
+static tmd* StoredTMD(u64 titleID, u32* size) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	TitlePath(path, titleID, "title.tmd");
+	signed_blob* s_tmd = ReadWhole(path, size);
+	return s_tmd ? SIGNATURE_PAYLOAD(s_tmd) : NULL;
+}
+
+static void FreeStoredTMD(tmd* p_tmd) {
+	if (p_tmd)
+		free((u8*)p_tmd - sizeof(sig_rsa2048));
+}
+
+s32 ES_GetNumTitles(u32* cnt)                        { *cnt = 0; return 0; }
+s32 ES_GetTitles(u64* titles, u32 cnt)               { return 0; }
+
+s32 ES_GetTitleContentsCount(u64 titleID, u32* num) {
+	u32 size;
+	tmd* p_tmd = StoredTMD(titleID, &size);
+	if (!p_tmd)
+		return ES_ENOENT;
+
+	*num = p_tmd->num_contents;
+	FreeStoredTMD(p_tmd);
+	return 0;
+}
+
+s32 ES_GetStoredTMDSize(u64 titleID, u32* size) {
+	tmd* p_tmd = StoredTMD(titleID, size);
+	if (!p_tmd)
+		return ES_ENOENT;
+
+	FreeStoredTMD(p_tmd);
+	return 0;
+}
+
+s32 ES_GetStoredTMD(u64 titleID, signed_blob* stmd, u32 size) {
+	u32 stored;
+	tmd* p_tmd = StoredTMD(titleID, &stored);
+	if (!p_tmd)
+		return ES_ENOENT;
+
+	memcpy(stmd, (u8*)p_tmd - sizeof(sig_rsa2048), size < stored ? size : stored);
+	FreeStoredTMD(p_tmd);
+	return 0;
+}
+
+s32 ES_GetTMDViewSize(u64 titleID, u32* size) {
+	u32 stored;
+	tmd* p_tmd = StoredTMD(titleID, &stored);
+	if (!p_tmd)
+		return ES_ENOENT;
+
+	*size = sizeof(tmd_view) + sizeof(tmd_view_content) * p_tmd->num_contents;
+	FreeStoredTMD(p_tmd);
+	return 0;
+}
+
+s32 ES_GetTMDView(u64 titleID, u8* data, u32 size) {
+	u32 stored;
+	tmd_view* view = (tmd_view*)data;
+	tmd* p_tmd = StoredTMD(titleID, &stored);
+	if (!p_tmd)
+		return ES_ENOENT;
+
+	memset(data, 0, size);
+	view->version       = p_tmd->version;
+	view->sys_version   = p_tmd->sys_version;
+	view->title_id      = p_tmd->title_id;
+	view->title_type    = p_tmd->title_type;
+	view->group_id      = p_tmd->group_id;
+	view->title_version = p_tmd->title_version;
+	view->num_contents  = p_tmd->num_contents;
+	for (int i = 0; i < p_tmd->num_contents && sizeof(tmd_view) + sizeof(tmd_view_content) * (i + 1) <= size; i++) {
+		view->contents[i].cid   = p_tmd->contents[i].cid;
+		view->contents[i].index = p_tmd->contents[i].index;
+		view->contents[i].type  = p_tmd->contents[i].type;
+		view->contents[i].size  = p_tmd->contents[i].size;
+	}
+
+	FreeStoredTMD(p_tmd);
+	return 0;
+}
+
+s32 ES_GetNumTicketViews(u64 titleID, u32* cnt) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	struct stat st;
+
+	TicketPath(path, titleID);
+	*cnt = (stat(path, &st) == 0);
+	return 0;
+}
+
+s32 ES_GetTicketViews(u64 titleID, tikview* views, u32 cnt) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	u32 size;
+
+	TicketPath(path, titleID);
+	signed_blob* s_tik = ReadWhole(path, &size);
+	if (!s_tik)
+		return ES_ENOENT;
+
+	tik* p_tik = SIGNATURE_PAYLOAD(s_tik);
+	if (cnt) {
+		memset(views, 0, sizeof(tikview));
+		views->ticketid    = p_tik->ticketid;
+		views->devicetype  = p_tik->devicetype;
+		views->titleid     = p_tik->titleid;
+		views->access_mask = p_tik->access_mask;
+	}
+
+	free(s_tik);
+	return 0;
+}
+
+s32 ES_AddTicket(const signed_blob* tik_blob, u32 tik_size, const signed_blob* certificates, u32 certificates_size, const signed_blob* crl, u32 crl_size) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	tik* p_tik = SIGNATURE_PAYLOAD(tik_blob);
+
+	TicketPath(path, p_tik->titleid);
+	MakeParents(path);
+
+	FILE* fp = fopen(path, "wb");
+	if (!fp)
+		return ISFSError();
+
+	size_t written = fwrite(tik_blob, 1, tik_size, fp);
+	fclose(fp);
+	return (written == tik_size) ? 0 : ES_EINVAL;
+}
+
+s32 ES_AddTitleCancel(void) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	if (import.fd > 0)
+		close(import.fd);
+
+	for (int i = 0; import.tmd && i < import.tmd->num_contents; i++) {
+		ImportPath(path, import.tmd->contents[i].cid);
+		remove(path);
+	}
+
+	free(import.s_tmd);
+	memset(&import, 0, sizeof(import));
+	return 0;
+}
+
+s32 ES_AddTitleStart(const signed_blob* tmd_blob, u32 tmd_size, const signed_blob* certificates, u32 certificates_size, const signed_blob* crl, u32 crl_size) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	aeskey key;
+	u32 size;
+
+	ES_AddTitleCancel();
+
+	tmd* p_tmd = SIGNATURE_PAYLOAD(tmd_blob);
+	TicketPath(path, p_tmd->title_id);
+	signed_blob* s_tik = ReadWhole(path, &size);
+	if (!s_tik)
+		return ES_EINVAL;
+
+	GetTitleKey(SIGNATURE_PAYLOAD(s_tik), key);
+	free(s_tik);
+
+	import.s_tmd = malloc(tmd_size);
+	if (!import.s_tmd)
+		return ES_EINVAL;
+
+	memcpy(import.s_tmd, tmd_blob, tmd_size);
+	import.tmd_size = tmd_size;
+	import.tmd = SIGNATURE_PAYLOAD(import.s_tmd);
+	mbedtls_aes_setkey_dec(&import.aes, key, 128);
+
+	ImportPath(path, 0);
+	MakeParents(path);
+	return 0;
+}
+
+s32 ES_AddContentStart(u64 titleID, u32 cid) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	if (!import.tmd || import.content || import.tmd->title_id != titleID)
+		return ES_EINVAL;
+
+	for (int i = 0; i < import.tmd->num_contents; i++) {
+		if (import.tmd->contents[i].cid == cid)
+			import.content = import.tmd->contents + i;
+	}
+	if (!import.content)
+		return ES_EINVAL;
+
+	ImportPath(path, cid);
+	import.fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+	if (import.fd < 0) {
+		import.content = NULL;
+		return ISFSError();
+	}
+
+	import.iv   = ContentIV(import.content->index);
+	import.left = import.content->size;
+	mbedtls_sha1_init(&import.sha);
+	mbedtls_sha1_starts_ret(&import.sha);
+	return import.fd;
+}
+
+s32 ES_AddContentData(s32 cfd, u8* data, u32 data_size) {
+	if (!import.content || cfd != import.fd || !__builtin_is_aligned(data, 0x20) || data_size % 16)
+		return ES_EINVAL;
+
+	u8* plain = malloc(data_size);
+	if (!plain)
+		return ES_EINVAL;
+
+	u32 length = (import.left < data_size) ? import.left : data_size;
+	mbedtls_aes_crypt_cbc(&import.aes, MBEDTLS_AES_DECRYPT, data_size, import.iv.full, data, plain);
+	mbedtls_sha1_update_ret(&import.sha, plain, length);
+	ssize_t written = write(import.fd, plain, length);
+	free(plain);
+
+	import.left -= length;
+	return (written == length) ? 0 : ISFSError();
+}
+
+s32 ES_AddContentFinish(u32 cfd) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+	sha1 hash;
+
+	if (!import.content || cfd != import.fd)
+		return ES_EINVAL;
+
+	close(import.fd);
+	mbedtls_sha1_finish_ret(&import.sha, hash);
+	mbedtls_sha1_free(&import.sha);
+
+	s32 ret = (import.left || memcmp(hash, import.content->hash, sizeof(sha1))) ? ES_EHASH : 0;
+	if (ret < 0) {
+		ImportPath(path, import.content->cid);
+		remove(path);
+	}
+
+	import.fd = 0;
+	import.content = NULL;
+	return ret;
+}
+
+s32 ES_AddTitleFinish(void) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH], dest[sizeof(HostNAND) + ISFS_MAXPATH], name[16];
+	struct stat st;
+
+	if (!import.tmd || import.content)
+		return ES_EINVAL;
+
+	TitlePath(dest, import.tmd->title_id, "title.tmd");
+	MakeParents(dest);
+
+	// Whatever didn't come in this time has to be there from before.
+	for (int i = 0; i < import.tmd->num_contents; i++) {
+		tmd_content* content = import.tmd->contents + i;
+
+		ImportPath(path, content->cid);
+		if (content->type & 0x8000) {
+			remove(path);
+			continue;
+		}
+
+		sprintf(name, "%08x.app", content->cid);
+		TitlePath(dest, import.tmd->title_id, name);
+		if (rename(path, dest) < 0 && stat(dest, &st) < 0) {
+			ES_AddTitleCancel();
+			return ES_EINVAL;
+		}
+	}
+
+	TitlePath(dest, import.tmd->title_id, "title.tmd");
+	FILE* fp = fopen(dest, "wb");
+	if (!fp)
+		return ISFSError();
+
+	fwrite(import.s_tmd, 1, import.tmd_size, fp);
+	fclose(fp);
+
+	free(import.s_tmd);
+	memset(&import, 0, sizeof(import));
+	return 0;
+}
+
+// The content directory and everything in it.
+s32 ES_DeleteTitleContent(u64 titleID) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH], name[16];
+	u32 size;
+
+	tmd* p_tmd = StoredTMD(titleID, &size);
+	if (!p_tmd)
+		return ES_ENOENT;
+
+	for (int i = 0; i < p_tmd->num_contents; i++) {
+		sprintf(name, "%08x.app", p_tmd->contents[i].cid);
+		TitlePath(path, titleID, name);
+		remove(path);
+	}
+
+	FreeStoredTMD(p_tmd);
+	return 0;
+}
+
+s32 ES_DeleteTitle(u64 titleID) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	ES_DeleteTitleContent(titleID);
+
+	TitlePath(path, titleID, "title.tmd");
+	if (remove(path) < 0)
+		return ES_ENOENT;
+
+	TitlePath(path, titleID, NULL);
+	strcat(path, "/content");
+	rmdir(path);
+	*strrchr(path, '/') = 0;
+	rmdir(path);
+	return 0;
+}
+
+s32 ES_DeleteTicket(const tikview* view) {
+	char path[sizeof(HostNAND) + ISFS_MAXPATH];
+
+	TicketPath(path, view->titleid);
+	return (remove(path) < 0) ? ES_ENOENT : 0;
+}
+
+/* /dev/aes */
+
+s32 AES_Init(void)  { return 0; }
+s32 AES_Close(void) { return 0; }
+
+static s32 AESCrypt(int mode, const void* key, u32 key_size, void* iv, u32 iv_size, const void* in_data, void* out_data, u32 data_size) {
+	mbedtls_aes_context aes;
+	unsigned char chain[16];
+
+	if (key_size != 16 || iv_size != 16 || !data_size || data_size % 16)
+		return IPC_EINVAL;
+
+	if (!__builtin_is_aligned(key, 0x20) || !__builtin_is_aligned(iv, 0x20)
+	|| !__builtin_is_aligned(in_data, 0x20) || !__builtin_is_aligned(out_data, 0x20))
+		return IPC_EINVAL;
+
+	// The engine doesn't hand the IV back, the caller works out the next one.
+	memcpy(chain, iv, sizeof(chain));
+
+	mbedtls_aes_init(&aes);
+	(mode == MBEDTLS_AES_ENCRYPT ? mbedtls_aes_setkey_enc : mbedtls_aes_setkey_dec)(&aes, key, 128);
+	mbedtls_aes_crypt_cbc(&aes, mode, data_size, chain, in_data, out_data);
+	mbedtls_aes_free(&aes);
+	return 0;
+}
+
+s32 AES_Encrypt(const void* key, u32 key_size, void* iv, u32 iv_size, const void* in_data, void* out_data, u32 data_size) {
+	return AESCrypt(MBEDTLS_AES_ENCRYPT, key, key_size, iv, iv_size, in_data, out_data, data_size);
+}
+
+s32 AES_Decrypt(const void* key, u32 key_size, void* iv, u32 iv_size, const void* in_data, void* out_data, u32 data_size) {
+	return AESCrypt(MBEDTLS_AES_DECRYPT, key, key_size, iv, iv_size, in_data, out_data, data_size);
+}
+
+/* /dev/sha. The lengths in the context are in bits, like IOS keeps them. */
+
+s32 SHA_Init(void)  { return 0; }
+s32 SHA_Close(void) { return 0; }
+
+static void SHALoad(const sha_context* context, mbedtls_sha1_context* sha) {
+	u64 bytes = (((u64)context->upper_length << 32) | context->lower_length) / 8;
+
+	mbedtls_sha1_init(sha);
+	mbedtls_sha1_starts_ret(sha);
+	memcpy(sha->state, context->states, sizeof(context->states));
+	sha->total[0] = (uint32_t)bytes;
+	sha->total[1] = (uint32_t)(bytes >> 32);
+}
+
+static void SHAStore(sha_context* context, const mbedtls_sha1_context* sha) {
+	u64 bits = ((((u64)sha->total[1]) << 32) | sha->total[0]) * 8;
+
+	memcpy(context->states, sha->state, sizeof(context->states));
+	context->upper_length = bits >> 32;
+	context->lower_length = (u32)bits;
+}
+
+s32 SHA_InitializeContext(const sha_context* context) {
+	mbedtls_sha1_context sha;
+
+	if (!__builtin_is_aligned(context, 0x20))
+		return IPC_EINVAL;
+
+	mbedtls_sha1_init(&sha);
+	mbedtls_sha1_starts_ret(&sha);
+	SHAStore((sha_context*)context, &sha);
+	return 0;
+}
+
+s32 SHA_Input(const sha_context* context, const void* data, u32 data_size) {
+	mbedtls_sha1_context sha;
+
+	if (!__builtin_is_aligned(context, 0x20) || !__builtin_is_aligned(data, 0x40) || data_size % 64)
+		return IPC_EINVAL;
+
+	SHALoad(context, &sha);
+	mbedtls_sha1_update_ret(&sha, data, data_size);
+	SHAStore((sha_context*)context, &sha);
+	return 0;
+}
+
+s32 SHA_Finalize(const sha_context* context, const void* data, u32 data_size, void* message_digest) {
+	mbedtls_sha1_context sha;
+
+	if (!__builtin_is_aligned(context, 0x20) || !__builtin_is_aligned(message_digest, 0x20)
+	|| (data_size && !__builtin_is_aligned(data, 0x40)))
+		return IPC_EINVAL;
+
+	SHALoad(context, &sha);
+	mbedtls_sha1_update_ret(&sha, data, data_size);
+	mbedtls_sha1_finish_ret(&sha, message_digest);
+	return 0;
+}
+
+s32 SHA_Calculate(const void* data, u32 data_size, void* message_digest) {
+	sha_context context __attribute__((aligned(0x20)));
+
+	SHA_InitializeContext(&context);
+	return SHA_Finalize(&context, data, data_size, message_digest);
+}
+
+/* wiisocket */
+
+int  wiisocket_init(void)       { return 0; }
+void wiisocket_deinit(void)     {}
+int  wiisocket_get_status(void) { return 1; }
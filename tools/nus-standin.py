@@ -0,0 +1,425 @@
+#!/usr/bin/env python3
+"""
+A stand-in for the NUS content server, for benchmarking restores without Nintendo's servers
+(or with them, but cached).
+
+Serves /<scenario>/ccs/download/<tid>/{tmd,tmd.<rev>,cetk,<cid>} out of <root>/<tid>/<file>.
+Each scenario shapes the responses: latency before the first byte, a bandwidth cap per connection, and
+a chance of a 503 or a stalled transfer. /scenarios lists them, one per line. /ccs/download/... is
+unshaped. /<scenario>/blob/<bytes> is that many random bytes, for download benchmarks.
+
+POST /nus/services/NetUpdateSOAP answers GetSystemUpdate with every title in the fixture directory
+that has a TMD, at that TMD's version (or with --update-list, "<title ID> <version>" per line).
+
+Build the restorer with `make BENCHMARK=1 BENCH_SERVER=http://<this machine>:<port>`.
+
+--replay takes a session trace recorded on a console (`make RECORD=1`, sd:/restorer-session.trc), or by
+tools/host (`make -C tools/host RECORD=1`, restorer-session.trc in the working directory). It adds a
+scenario that answers each request the way the recorded one went: same status, same duration, cut off
+at the same byte. /<scenario>/trace hands the trace to the console (or `restorer-host replay`) so its
+emulated ES can take as long as the recording console's did.
+"""
+
+import argparse
+import collections
+import functools
+import io
+import os
+import random
+import re
+import shutil
+import sys
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+DEFAULT_SCENARIOS = [
+    "lan:latency=0,bandwidth=0",
+    "wifi:latency=30,bandwidth=600,fail=0.01",
+    "bad-wifi:latency=150,bandwidth=150,stall=0.05,fail=0.05",
+]
+
+PATH_RE = re.compile(r"^(?:/(?P<scenario>[\w.-]+))?/ccs/download/(?P<tid>[0-9a-fA-F]{16})/(?P<file>tmd(?:\.\d+)?|cetk|[0-9a-fA-F]{8})$")
+TRACE_RE = re.compile(r"^/(?P<scenario>[\w.-]+)/trace$")
+BLOB_RE = re.compile(r"^(?:/(?P<scenario>[\w.-]+))?/blob/(?P<size>\d+)$")
+RANGE_RE = re.compile(r"^bytes=(\d+)-(\d*)$")
+SOAP_PATH = "/nus/services/NetUpdateSOAP"
+
+# Offset of title_version in a TMD signed with RSA-2048, which they all are.
+TMD_VERSION_OFFSET = 0x1DC
+
+# One HTTP attempt from a session trace. See trace.h.
+Attempt = collections.namedtuple("Attempt", "duration status result offset length")
+
+
+class Scenario:
+    def __init__(self, spec):
+        name, _, params = spec.partition(":")
+        self.name = name
+        self.latency = 0.0    # ms
+        self.bandwidth = 0.0  # KB/s, 0 for unlimited
+        self.fail = 0.0       # chance of a 503
+        self.stall = 0.0      # chance of going quiet halfway through
+        for param in filter(None, params.split(",")):
+            key, _, value = param.partition("=")
+            if not hasattr(self, key) or key == "name":
+                raise ValueError(f"unknown scenario parameter {key!r} in {spec!r}")
+            setattr(self, key, float(value))
+
+        self.trace = None
+        self.attempts = {}
+
+
+class ReplayScenario(Scenario):
+    def __init__(self, name, path):
+        super().__init__(name)
+        self.trace = path
+        self.attempts = collections.defaultdict(collections.deque)
+
+        with open(path) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) != 9 or fields[0] != "H":
+                    continue
+
+                _, _, duration, status, result, offset, length, _, url = fields
+                _, _, request = url.partition("/ccs/download/")
+                if request:
+                    self.attempts[request.lower()].append(
+                        Attempt(int(duration) / 1000, int(status), int(result), int(offset), int(length)))
+
+    def next_attempt(self, tid, name, offset):
+        # Once the recorded attempts run out, the rest succeed without any shaping.
+        queue = self.attempts.get(f"{tid}/{name}".lower())
+        if not queue:
+            return None
+
+        # A segmented download's ranges come in whatever order the connections get there, so go by where
+        # each one starts. A plain download (or a resumed one) starts where the recorded one did anyway.
+        # One that never started there goes unshaped.
+        for attempt in queue:
+            if attempt.offset == offset:
+                queue.remove(attempt)
+                return attempt
+
+        return None
+
+
+@functools.lru_cache(maxsize=4)
+def blob(size):
+    # Anything that doesn't compress, for download benchmarks. Same bytes every time.
+    return random.Random(size).randbytes(size)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "nus-standin/1.0"
+
+    def log_message(self, fmt, *args):
+        if not self.server.quiet:
+            super().log_message(fmt, *args)
+
+    def fixture(self, tid, name):
+        path = os.path.join(self.server.root, tid.lower(), name.lower())
+        if os.path.isfile(path) or not self.server.upstream:
+            return path
+
+        # Fill the fixture directory from upstream on a miss.
+        url = f"{self.server.upstream}/ccs/download/{tid.lower()}/{name.lower()}"
+        try:
+            with urllib.request.urlopen(url, timeout=30) as response:
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+                with open(path + ".part", "wb") as out:
+                    shutil.copyfileobj(response, out)
+            os.replace(path + ".part", path)
+        except OSError as e:
+            self.log_error("upstream fetch of %s failed: %s", url, e)
+
+        return path
+
+    def do_GET(self):
+        if self.path == "/scenarios":
+            body = "".join(f"{name}\n" for name in self.server.scenarios).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "text/plain")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+
+        match = TRACE_RE.match(self.path)
+        if match:
+            scenario = self.server.scenarios.get(match["scenario"])
+            if not scenario or not scenario.trace:
+                self.send_error(404)
+                return
+
+            self.send_file(scenario.trace, "text/plain")
+            return
+
+        match = BLOB_RE.match(self.path)
+        if match:
+            scenario = self.get_scenario(match["scenario"])
+            if scenario is not False:
+                size = int(match["size"])
+                self.serve(io.BytesIO(blob(size)), size, scenario)
+            return
+
+        match = PATH_RE.match(self.path)
+        if not match:
+            self.send_error(404)
+            return
+
+        scenario = self.get_scenario(match["scenario"])
+        if scenario is False:
+            return
+
+        path = self.fixture(match["tid"], match["file"])
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+
+        attempt = None
+        if scenario and scenario.trace:
+            byterange = self.get_range(os.path.getsize(path))
+            attempt = scenario.next_attempt(match["tid"], match["file"], byterange[0] if byterange else 0)
+        if attempt:
+            self.replay(path, attempt)
+            return
+
+        with open(path, "rb") as f:
+            self.serve(f, os.path.getsize(path), scenario)
+
+    def update_list(self):
+        if self.server.update_list:
+            with open(self.server.update_list) as f:
+                return [(int(tid, 16), int(version)) for tid, version in (line.split() for line in f if line.strip())]
+
+        titles = []
+        for tid in sorted(os.listdir(self.server.root)):
+            path = os.path.join(self.server.root, tid, "tmd")
+            if re.fullmatch(r"[0-9a-fA-F]{16}", tid) and os.path.isfile(path):
+                with open(path, "rb") as f:
+                    f.seek(TMD_VERSION_OFFSET)
+                    titles.append((int(tid, 16), int.from_bytes(f.read(2), "big")))
+
+        return titles
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        request = self.rfile.read(length).decode(errors="replace")
+
+        if self.path != SOAP_PATH or "GetSystemUpdateRequest" not in request:
+            self.send_error(404)
+            return
+
+        message = re.search(r"<MessageId>(\w+)</MessageId>", request)
+        entries = "".join(
+            f"<TitleVersion><TitleId>{tid:016X}</TitleId><Version>{version}</Version><FsSize>0</FsSize></TitleVersion>"
+            for tid, version in self.update_list())
+
+        body = (
+            '<?xml version="1.0" encoding="utf-8"?>'
+            '<soapenv:Envelope xmlns:soapenv="http://schemas.xmlsoap.org/soap/envelope/" '
+            'xmlns:xsd="http://www.w3.org/2001/XMLSchema" xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance">'
+            '<soapenv:Body><GetSystemUpdateResponse xmlns="urn:nus.wsapi.broadon.com">'
+            f'<Version>1.0</Version><DeviceId>0</DeviceId><MessageId>{message[1] if message else 0}</MessageId>'
+            f'<TimeStamp>{int(time.time() * 1000)}</TimeStamp><ErrorCode>0</ErrorCode>'
+            '<ContentPrefixURL>http://ccs.shop.wii.com/ccs/download</ContentPrefixURL>'
+            '<UncachedContentPrefixURL>http://ccs.cdn.shop.wii.com/ccs/download</UncachedContentPrefixURL>'
+            f'{entries}<UploadAuditData>1</UploadAuditData></GetSystemUpdateResponse></soapenv:Body></soapenv:Envelope>'
+        ).encode()
+
+        self.send_response(200)
+        self.send_header("Content-Type", "text/xml; charset=utf-8")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def get_scenario(self, name):
+        # None for no shaping at all, False (after a 404) for one that doesn't exist.
+        if not name:
+            return None
+
+        scenario = self.server.scenarios.get(name)
+        if not scenario:
+            self.send_error(404, "unknown scenario")
+            return False
+
+        return scenario
+
+    def get_range(self, size):
+        # [start, end) of what was asked for, None if that can't be done.
+        ranged = self.headers.get("Range")
+        if not ranged:
+            return 0, size
+
+        m = RANGE_RE.match(ranged)
+        if not m:
+            return None
+
+        start = int(m[1])
+        end = int(m[2]) + 1 if m[2] else size
+        if start >= size or end <= start:
+            return None
+
+        return start, min(end, size)
+
+    def send_range_headers(self, start, end, size):
+        ranged = self.headers.get("Range") is not None
+        self.send_response(206 if ranged else 200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(end - start))
+        if ranged:
+            self.send_header("Content-Range", f"bytes {start}-{end - 1}/{size}")
+        self.end_headers()
+
+    def serve(self, f, size, scenario):
+        if scenario:
+            time.sleep(scenario.latency / 1000)
+            if random.random() < scenario.fail:
+                self.send_error(503)
+                return
+
+        byterange = self.get_range(size)
+        if not byterange:
+            self.send_error(416)
+            return
+
+        start, end = byterange
+        self.send_range_headers(start, end, size)
+
+        stall_at = None
+        if scenario and random.random() < scenario.stall:
+            stall_at = start + (end - start) // 2
+
+        f.seek(start)
+        self.send_body(f, start, end, scenario, stall_at)
+
+    def send_file(self, path, content_type):
+        with open(path, "rb") as f:
+            body = f.read()
+
+        self.send_response(200)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def replay(self, path, attempt):
+        if attempt.status >= 400 or not attempt.status:
+            time.sleep(attempt.duration)
+            if attempt.status:
+                self.send_error(attempt.status)
+            else:
+                # Never got a response at all.
+                self.close_connection = True
+            return
+
+        # Where this console asked to start, which should be where the recorded one did.
+        size = os.path.getsize(path)
+        byterange = self.get_range(size)
+        if not byterange:
+            self.send_error(416)
+            return
+
+        start, stop = byterange
+        self.send_range_headers(start, stop, size)
+
+        # Same bytes in the same time, and if it was cut off, cut it off at the same place.
+        end = min(start + attempt.length, stop) if attempt.result else stop
+        with open(path, "rb") as f:
+            f.seek(start)
+            began = time.monotonic()
+            offset = start
+            while offset < end:
+                data = f.read(min(0x4000, end - offset))
+                if not data:
+                    break
+
+                try:
+                    self.wfile.write(data)
+                except (BrokenPipeError, ConnectionResetError):
+                    return
+
+                offset += len(data)
+                ahead = attempt.duration * (offset - start) / max(end - start, 1) - (time.monotonic() - began)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+        if offset < stop:
+            self.close_connection = True
+
+    def send_body(self, f, offset, size, scenario, stall_at):
+        chunk = 0x4000
+        began = time.monotonic()
+        sent = 0
+
+        while offset < size:
+            data = f.read(min(chunk, size - offset))
+            if not data:
+                break
+
+            if stall_at is not None and offset + len(data) > stall_at:
+                # Longer than the restorer's stall timeout, then hang up.
+                time.sleep(self.server.stall_seconds)
+                self.close_connection = True
+                return
+
+            try:
+                self.wfile.write(data)
+            except (BrokenPipeError, ConnectionResetError):
+                return
+
+            offset += len(data)
+            sent += len(data)
+
+            if scenario and scenario.bandwidth:
+                ahead = sent / (scenario.bandwidth * 1024) - (time.monotonic() - began)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("root", help="fixture directory, laid out as <tid>/<tmd|cetk|cid>")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--upstream", help="fetch missing fixtures from here, e.g. http://nus.cdn.shop.wii.com")
+    parser.add_argument("--scenario", action="append", metavar="NAME:key=value,...",
+                        help="latency (ms), bandwidth (KB/s), fail and stall (0-1). Replaces the defaults.")
+    parser.add_argument("--replay", action="append", metavar="[NAME=]TRACE", default=[],
+                        help="add a scenario replaying a session trace recorded with `make RECORD=1`")
+    parser.add_argument("--update-list", help="answer GetSystemUpdate with this instead of the fixtures")
+    parser.add_argument("--stall-seconds", type=float, default=20.0)
+    parser.add_argument("--seed", type=int, help="seed the failure injection, for repeatable runs")
+    parser.add_argument("--quiet", action="store_true")
+    args = parser.parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    # A console opens NUSDownloadSegments connections at once, more than socketserver's listen backlog of 5.
+    # The ones that don't fit get their SYN dropped and try again a second later.
+    ThreadingHTTPServer.request_queue_size = 64
+    server = ThreadingHTTPServer((args.bind, args.port), Handler)
+    server.root = args.root
+    server.upstream = args.upstream.rstrip("/") if args.upstream else None
+    server.scenarios = {s.name: s for s in map(Scenario, args.scenario or DEFAULT_SCENARIOS)}
+    for replay in args.replay:
+        name, _, path = replay.rpartition("=")
+        scenario = ReplayScenario(name or "replay", path)
+        server.scenarios[scenario.name] = scenario
+    server.update_list = args.update_list
+    server.stall_seconds = args.stall_seconds
+    server.quiet = args.quiet
+
+    print(f"Serving {args.root} on {args.bind}:{args.port}, scenarios: {', '.join(server.scenarios)}", file=sys.stderr)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+Builds a restorer cache (the staging layout, <out>/<tid>/{tmd,cetk,<cid>}) for every region at once,
+from a PC, so a shop can refresh its whole offline library in one go and hand it to consoles on an SD
+card, through `cache = ...` in restorer.ini, or with serve mode / nus-standin.py.
+
+The title list comes from channels[] in source/main.c: region-specific titles for J, E, P and K,
+region-free ones as they are, and the A/K pair for the rest. Plus whatever the install functions pull
+in on their own (EXTRA_TITLES).
+
+The downloading is nus.c's own, through tools/host (`restorer-host stage`, build it first), one
+title per process and --jobs of them at once. Contents are stored encrypted, as NUS serves them, and
+go through CheckStagedContent like on the console: anything already in <out> that checks out isn't
+downloaded again, anything that doesn't is.
+"""
+
+import argparse
+import concurrent.futures
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+NUS_SERVER = "http://nus.cdn.shop.wii.com"
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE_DIR = os.path.join(TOOLS_DIR, "..", "source")
+HOST_TOOL = os.path.join(TOOLS_DIR, "host", "restorer-host")
+
+REGIONS = "JEPK"
+
+# Pulled in by install_shop_channel (IOS61) and install_pc_1_1 (the Korean Photo Channel 1.0, for the dummy).
+EXTRA_TITLES = [0x000000010000003D, 0x000100024841414B]
+
+# The last line restorer-host prints, see InstallTitles() in tools/host/host.c.
+SUMMARY_RE = re.compile(r"(\d+) bytes +\d+ files +\d+ retries +\d+ failed\s*$")
+
+print_lock = threading.Lock()
+
+
+def log(*args):
+    with print_lock:
+        print(*args, file=sys.stderr)
+
+
+def parse_titles(main_c):
+    """Every title ID channels[] can resolve to, with the channel's name."""
+    source = open(main_c).read()
+    table = source[source.index("static Channel channels[] = {"):]
+    table = table[:table.index("\n};")]
+    titles = []
+
+    for entry in re.findall(r"\{(.*?)\n\t\}", table, re.S):
+        name = re.search(r'\.name\s*=\s*"([^"]*)"', entry).group(1)
+        base = 0
+        for part in re.search(r"\.titleID\s*=\s*([^,]+),", entry).group(1).split("|"):
+            base |= int(part.strip().rstrip("LlUu"), 0)
+
+        regiontype = (re.search(r"\.regiontype\s*=\s*regiontype_(\w+)", entry) or [None, "specific"])[1]
+        regionflag = (re.search(r"\.regionflag\s*=\s*regionflag_(\w+)", entry) or [None, ""])[1]
+
+        if regiontype == "free":
+            letters = [None]
+        elif regiontype == "freeandkr":
+            letters = ["A", "K"]
+        else:
+            letters = list("J" if regionflag == "jponly" else REGIONS)
+
+        for letter in letters:
+            if letter == "K" and regionflag == "nokr":
+                continue
+
+            titles.append((base | ord(letter) if letter else base, name))
+
+    return titles
+
+
+def stage(host, server, out, tid, name, workdir):
+    """Returns (bytes downloaded, ok)."""
+    # From inside out, the console's staging path only has room for 63 characters. The host build's
+    # NAND goes in workdir.
+    result = subprocess.run([host, "stage", server, ".", f"{tid:016x}"], cwd=out,
+                            env=dict(os.environ, RESTORER_NAND=os.path.join(workdir, "nand")),
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, errors="replace")
+
+    lines = [line for line in result.stdout.replace("\r", "\n").splitlines() if line.strip() and "KB/s" not in line]
+    summary = SUMMARY_RE.search(lines[-1]) if lines else None
+    downloaded = int(summary[1]) if summary else 0
+
+    if result.returncode:
+        log(f"{tid:016x} ({name}): failed!")
+        for line in lines[:-1]:
+            log(f"  {line.strip()}")
+    else:
+        log(f"{tid:016x}: {downloaded / 1048576:.2f} MB ({name})")
+
+    return downloaded, result.returncode == 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("out", help="cache directory, e.g. the restorer-cache folder on an SD card")
+    parser.add_argument("--server", default=NUS_SERVER, help="NUS or a mirror of it (nus-standin.py, serve mode)")
+    parser.add_argument("--jobs", type=int, default=4, help="titles at once")
+    parser.add_argument("--title", action="append", default=[], metavar="TID",
+                        help="only these title IDs (16 hex digits), can be repeated")
+    parser.add_argument("--list", action="store_true", help="print the title list and stop")
+    parser.add_argument("--host", default=HOST_TOOL, help="the restorer-host to download with")
+    args = parser.parse_args()
+
+    titles = parse_titles(os.path.join(SOURCE_DIR, "main.c"))
+    titles += [(tid, "dependency") for tid in EXTRA_TITLES]
+    titles = list(dict.fromkeys(titles))
+    if args.title:
+        names = dict(titles)
+        titles = [(tid, names.get(tid, "asked for")) for tid in dict.fromkeys(int(tid, 16) for tid in args.title)]
+
+    if args.list:
+        for tid, name in titles:
+            print(f"{tid:016x}  {name}")
+        return
+
+    if not os.access(args.host, os.X_OK):
+        sys.exit(f"{args.host} isn't there, build it first (make -C tools/host)")
+
+    server = args.server.rstrip("/")
+    os.makedirs(args.out, exist_ok=True)
+    began = time.monotonic()
+
+    with tempfile.TemporaryDirectory() as workdir, concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        results = list(pool.map(lambda entry: stage(args.host, server, args.out, *entry, workdir), titles))
+
+    downloaded = sum(size for size, ok in results)
+    failures = sum(not ok for size, ok in results)
+    elapsed = time.monotonic() - began
+    log(f"{len(titles)} titles, {downloaded / 1048576:.2f} MB downloaded in {elapsed:.1f}s "
+        f"({downloaded / 1024 / max(elapsed, 0.001):.0f} KB/s), {failures} failures")
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()